@@ -0,0 +1,515 @@
+/**
+ * @file bench.c
+ * @brief Benchmark of the arithmetic kernels.
+ * * Every kernel is timed on operands from 1 word up to the largest size,
+ * growing by a factor of ten. A measurement repeats the kernel until the
+ * minimum time has passed; only the kernel call itself is timed. Results are
+ * printed as CSV or JSON. A CSV file saved by an earlier run can be given as
+ * a baseline, slower results beyond the tolerance then fail the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bigint.h"
+#include "threadpool.h"
+#include "util.h"
+
+#define DEFAULT_MAX_WORDS 1000000   /* Largest operand size in words */
+#define DEFAULT_MIN_TIME_MS 200     /* Minimum time spent on one measurement */
+#define DEFAULT_TOLERANCE 20        /* Allowed slowdown against the baseline in percent */
+#define MAX_KERNEL_NAME 32
+#define MAX_RESULTS 128
+#define OPT_MAX_WORDS "--max-words="
+#define OPT_MIN_TIME "--min-time="
+#define OPT_FORMAT "--format="
+#define OPT_BASELINE "--baseline="
+#define OPT_TOLERANCE "--tolerance="
+#define OPT_KERNELS "--kernels="
+#define OPT_THREADS "--threads="
+
+/* Operands of one measurement, prepared outside of the timed part */
+typedef struct
+{
+    BigInt* a;
+    BigInt* b;
+    char* text;
+    uint32_t count;
+} BenchInput;
+
+typedef struct
+{
+    const char* name;
+    bool (*prepare)(BenchInput* input, size_t words);
+    bool (*run)(const BenchInput* input);
+} BenchKernel;
+
+/* Timed call of a kernel on prepared operands */
+typedef struct
+{
+    const BenchKernel* kernel;
+    const BenchInput* input;
+} BenchCall;
+
+typedef struct
+{
+    const char* kernel;
+    size_t words;
+    unsigned long iterations;
+    double ns_per_op;
+    double words_per_sec;
+    double baseline_ns;      /* 0 if the baseline has no such result */
+} BenchResult;
+
+typedef struct
+{
+    char kernel[MAX_KERNEL_NAME];
+    size_t words;
+    double ns_per_op;
+} BaselineEntry;
+
+static unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+
+/* HELP FUNCTIONS */
+
+/* Fixed seed so every run measures the same operands */
+static bi_word random_word(void)
+{
+    return (bi_word)util_random_next(&random_state);
+}
+
+/* Creates a random positive number of exactly the given number of words */
+static BigInt* random_number(size_t words)
+{
+    BigInt* n = bi_create();
+    size_t i;
+
+    if (!n || !bi_resize(n, words))
+    {
+        bi_destroy(n);
+        return NULL;
+    }
+    for (i = 0; i < words; i++)
+    {
+        n->digits[i] = random_word();
+    }
+    n->digits[words - 1] |= (bi_word)1 << (BI_WORD_BITS - 1);
+    n->length = words;
+    n->sign = 1;
+    return n;
+}
+
+/* Small number from a word value */
+static BigInt* word_number(bi_word value)
+{
+    BigInt* n = bi_create();
+
+    if (!n) return NULL;
+    n->digits[0] = value;
+    n->sign = value ? 1 : 0;
+    return n;
+}
+
+/* Approximate bit length of m!, log2(m) interpolated between powers of two */
+static double fact_bits(uint32_t m)
+{
+    double log2_m = 0.0;
+    uint32_t top = 1;
+
+    if (m < 2) return 0.0;
+    while (top <= m / 2)
+    {
+        top *= 2;
+        log2_m += 1.0;
+    }
+    log2_m += (double)m / (double)top - 1.0;
+
+    /* Stirling: m log2 m - m log2 e */
+    return (double)m * log2_m - (double)m * 1.4426950408889634;
+}
+
+static void release_input(BenchInput* input)
+{
+    bi_destroy(input->a);
+    bi_destroy(input->b);
+    free(input->text);
+    memset(input, 0, sizeof(BenchInput));
+}
+
+/* KERNELS */
+
+static bool prepare_mul(BenchInput* input, size_t words)
+{
+    input->a = random_number(words);
+    input->b = random_number(words);
+    return input->a && input->b;
+}
+
+static bool run_mul(const BenchInput* input)
+{
+    BigInt* r = bi_mul(input->a, input->b);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+/* Dividend of twice the size of the divisor, the usual shape of a reduction */
+static bool prepare_div(BenchInput* input, size_t words)
+{
+    input->a = random_number(2 * words);
+    input->b = random_number(words);
+    return input->a && input->b;
+}
+
+static bool run_div(const BenchInput* input)
+{
+    BigInt* q = NULL;
+    BigInt* r = NULL;
+    bool ok;
+
+    bi_div_mod_abs(input->a, input->b, &q, &r);
+    ok = q && r;
+    bi_destroy(q);
+    bi_destroy(r);
+    return ok;
+}
+
+/* Odd one word base, the exponent is chosen so the power has the given size */
+static bool prepare_pow(BenchInput* input, size_t words)
+{
+    input->a = word_number(random_word() | ((bi_word)1 << (BI_WORD_BITS - 1)) | 1);
+    input->b = word_number((bi_word)words);
+    return input->a && input->b;
+}
+
+static bool run_pow(const BenchInput* input)
+{
+    BigInt* r = bi_pow(input->a, input->b);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+/* Smallest m whose factorial has about the given size */
+static bool prepare_fact(BenchInput* input, size_t words)
+{
+    double bits = (double)words * BI_WORD_BITS;
+    uint32_t low = 1, high = 1;
+    uint32_t middle;
+
+    while (fact_bits(high) < bits && high < 0x80000000u) high *= 2;
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (fact_bits(middle) < bits) low = middle + 1;
+        else high = middle;
+    }
+    input->count = low;
+    return true;
+}
+
+static bool run_fact(const BenchInput* input)
+{
+    BigInt* r = bi_fact(input->count);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+static bool prepare_to_dec(BenchInput* input, size_t words)
+{
+    input->a = random_number(words);
+    return input->a != NULL;
+}
+
+static bool run_to_dec(const BenchInput* input)
+{
+    char* text = bi_to_dec(input->a);
+
+    free(text);
+    return text != NULL;
+}
+
+static bool prepare_from_dec(BenchInput* input, size_t words)
+{
+    BigInt* n = random_number(words);
+
+    if (!n) return false;
+    input->text = bi_to_dec(n);
+    bi_destroy(n);
+    return input->text != NULL;
+}
+
+static bool run_from_dec(const BenchInput* input)
+{
+    BigInt* r = bi_from_dec(input->text);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+static const BenchKernel kernels[] =
+{
+    { "mul", prepare_mul, run_mul },
+    { "div_mod", prepare_div, run_div },
+    { "pow", prepare_pow, run_pow },
+    { "fact", prepare_fact, run_fact },
+    { "to_dec", prepare_to_dec, run_to_dec },
+    { "from_dec", prepare_from_dec, run_from_dec }
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+/* MEASUREMENT */
+
+static bool run_call(void* context)
+{
+    const BenchCall* call = (const BenchCall*)context;
+
+    return call->kernel->run(call->input);
+}
+
+static bool measure(const BenchKernel* kernel, size_t words, double min_time_ns, BenchResult* result)
+{
+    BenchInput input;
+    BenchCall call;
+    unsigned long iterations;
+    double ns_per_op;
+
+    memset(&input, 0, sizeof(BenchInput));
+    if (!kernel->prepare(&input, words))
+    {
+        release_input(&input);
+        return false;
+    }
+
+    call.kernel = kernel;
+    call.input = &input;
+    ns_per_op = util_measure(run_call, &call, min_time_ns, &iterations);
+    release_input(&input);
+    if (ns_per_op < 0.0) return false;
+
+    result->kernel = kernel->name;
+    result->words = words;
+    result->iterations = iterations;
+    result->ns_per_op = ns_per_op;
+    result->words_per_sec = (double)words * 1e9 / result->ns_per_op;
+    result->baseline_ns = 0.0;
+    return true;
+}
+
+/* BASELINE */
+
+/* Reads a CSV file written by this program, returns the number of entries or -1 */
+static long load_baseline(const char* path, BaselineEntry* entries, size_t max_entries)
+{
+    FILE* f = fopen(path, "r");
+    char line[256];
+    unsigned long words;
+    size_t count = 0;
+
+    if (!f) return -1;
+    while (count < max_entries && fgets(line, sizeof(line), f))
+    {
+        /* The header and comparison columns are skipped */
+        if (sscanf(line, "%31[^,],%lu,%*u,%lf", entries[count].kernel, &words, &entries[count].ns_per_op) == 3)
+        {
+            entries[count].words = (size_t)words;
+            count++;
+        }
+    }
+    fclose(f);
+    return (long)count;
+}
+
+static const BaselineEntry* find_baseline(const BaselineEntry* entries, size_t count, const BenchResult* result)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (entries[i].words == result->words && strcmp(entries[i].kernel, result->kernel) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* OUTPUT */
+
+static void print_csv(const BenchResult* results, size_t count, bool compare)
+{
+    size_t i;
+
+    printf("kernel,words,iterations,ns_per_op,words_per_sec%s\n", compare ? ",baseline_ns_per_op,ratio" : "");
+    for (i = 0; i < count; i++)
+    {
+        printf("%s,%lu,%lu,%.1f,%.1f", results[i].kernel, (unsigned long)results[i].words,
+               results[i].iterations, results[i].ns_per_op, results[i].words_per_sec);
+        if (compare && results[i].baseline_ns > 0.0)
+        {
+            printf(",%.1f,%.3f", results[i].baseline_ns, results[i].ns_per_op / results[i].baseline_ns);
+        }
+        else if (compare)
+        {
+            printf(",,");
+        }
+        printf("\n");
+    }
+}
+
+static void print_json(const BenchResult* results, size_t count, bool compare)
+{
+    size_t i;
+
+    printf("{\n  \"word_bits\": %d,\n  \"threads\": %lu,\n  \"results\": [\n",
+           BI_WORD_BITS, (unsigned long)thread_pool_size() + 1);
+    for (i = 0; i < count; i++)
+    {
+        printf("    { \"kernel\": \"%s\", \"words\": %lu, \"iterations\": %lu, \"ns_per_op\": %.1f, \"words_per_sec\": %.1f",
+               results[i].kernel, (unsigned long)results[i].words, results[i].iterations,
+               results[i].ns_per_op, results[i].words_per_sec);
+        if (compare && results[i].baseline_ns > 0.0)
+        {
+            printf(", \"baseline_ns_per_op\": %.1f, \"ratio\": %.3f",
+                   results[i].baseline_ns, results[i].ns_per_op / results[i].baseline_ns);
+        }
+        printf(" }%s\n", i + 1 < count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void print_usage(void)
+{
+    printf("Usage: bench.exe [options]\n"
+           "  --max-words=N   largest operand size in words (default %d)\n"
+           "  --min-time=MS   minimum time of one measurement (default %d)\n"
+           "  --format=F      csv or json (default csv)\n"
+           "  --kernels=LIST  comma separated subset of mul,div_mod,pow,fact,to_dec,from_dec\n"
+           "  --threads=N     threads for the parallel kernels (default 1)\n"
+           "  --baseline=FILE CSV output of an earlier run to compare against\n"
+           "  --tolerance=P   allowed slowdown against the baseline in percent (default %d)\n",
+           DEFAULT_MAX_WORDS, DEFAULT_MIN_TIME_MS, DEFAULT_TOLERANCE);
+}
+
+int main(int argc, char* argv[])
+{
+    static BenchResult results[MAX_RESULTS];
+    static BaselineEntry baseline[MAX_RESULTS];
+    unsigned long max_words = DEFAULT_MAX_WORDS;
+    unsigned long min_time_ms = DEFAULT_MIN_TIME_MS;
+    unsigned long tolerance = DEFAULT_TOLERANCE;
+    unsigned long threads = 1;
+    unsigned long value;
+    const char* baseline_path = NULL;
+    const char* kernel_list = NULL;
+    bool json = false;
+    long baseline_count = 0;
+    size_t result_count = 0;
+    size_t regressions = 0;
+    size_t words, k, i;
+    const BaselineEntry* entry;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp(argv[arg], OPT_MAX_WORDS, strlen(OPT_MAX_WORDS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MAX_WORDS), &value) && value > 0)
+        {
+            max_words = value;
+        }
+        else if (strncmp(argv[arg], OPT_MIN_TIME, strlen(OPT_MIN_TIME)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MIN_TIME), &value))
+        {
+            min_time_ms = value;
+        }
+        else if (strncmp(argv[arg], OPT_TOLERANCE, strlen(OPT_TOLERANCE)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_TOLERANCE), &value))
+        {
+            tolerance = value;
+        }
+        else if (strncmp(argv[arg], OPT_THREADS, strlen(OPT_THREADS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_THREADS), &value) && value > 0)
+        {
+            threads = value;
+        }
+        else if (strcmp(argv[arg], OPT_FORMAT "json") == 0)
+        {
+            json = true;
+        }
+        else if (strcmp(argv[arg], OPT_FORMAT "csv") == 0)
+        {
+            json = false;
+        }
+        else if (strncmp(argv[arg], OPT_BASELINE, strlen(OPT_BASELINE)) == 0)
+        {
+            baseline_path = argv[arg] + strlen(OPT_BASELINE);
+        }
+        else if (strncmp(argv[arg], OPT_KERNELS, strlen(OPT_KERNELS)) == 0)
+        {
+            kernel_list = argv[arg] + strlen(OPT_KERNELS);
+        }
+        else
+        {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (baseline_path)
+    {
+        baseline_count = load_baseline(baseline_path, baseline, MAX_RESULTS);
+        if (baseline_count < 0)
+        {
+            fprintf(stderr, "Cannot read baseline \"%s\"!\n", baseline_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (threads > 1 && !thread_pool_start((size_t)(threads - 1)))
+    {
+        fprintf(stderr, "Cannot start %lu threads!\n", threads);
+        return EXIT_FAILURE;
+    }
+
+    for (k = 0; k < KERNEL_COUNT; k++)
+    {
+        if (!util_list_contains(kernel_list, kernels[k].name)) continue;
+
+        for (words = 1; words <= max_words && result_count < MAX_RESULTS; words *= 10)
+        {
+            if (!measure(&kernels[k], words, (double)min_time_ms * 1e6, &results[result_count]))
+            {
+                fprintf(stderr, "Kernel %s failed at %lu words!\n", kernels[k].name, (unsigned long)words);
+                continue;
+            }
+            fprintf(stderr, "%s %lu words: %.1f ns/op\n", kernels[k].name, (unsigned long)words,
+                    results[result_count].ns_per_op);
+            result_count++;
+            if (words > (size_t)-1 / 10) break;
+        }
+    }
+
+    for (i = 0; i < result_count; i++)
+    {
+        entry = find_baseline(baseline, (size_t)baseline_count, &results[i]);
+        if (!entry || entry->ns_per_op <= 0.0) continue;
+
+        results[i].baseline_ns = entry->ns_per_op;
+        if (results[i].ns_per_op > entry->ns_per_op * (1.0 + (double)tolerance / 100.0))
+        {
+            fprintf(stderr, "Regression: %s at %lu words is %.1f%% slower\n", results[i].kernel,
+                    (unsigned long)results[i].words, (results[i].ns_per_op / entry->ns_per_op - 1.0) * 100.0);
+            regressions++;
+        }
+    }
+
+    if (json) print_json(results, result_count, baseline_path != NULL);
+    else print_csv(results, result_count, baseline_path != NULL);
+
+    thread_pool_stop();
+    bi_free_caches();
+    return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
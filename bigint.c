@@ -2,25 +2,51 @@
  * @file bigint.c
  * @brief Implementation of high precision integer arithmetic.
  * * This file contains the core logic for basic BigInt operations.
- * Using 32-bit words (base 2^32) for better performance.
+ * Using 64-bit words (base 2^64) where unsigned __int128 is available and
+ * 32-bit words (base 2^32) otherwise, see BI_WORD_BITS.
  */
 
 #include "bigint.h"
+#include "bigint_tuning.h"
+#include "threadpool.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <strings.h>
+#include <pthread.h>
 
-#define INITIAL_CAPACITY 4  /* Initial capacity for digits */
 #define BASE_DEC 10         /* Decimal system base */
-#define HEX_WIDTH 8         /* Number of digits for one 32bit word */
-#define BITS_IN_WORD 32     /* Size of word in bits */
+#define BITS_IN_WORD BI_WORD_BITS          /* Size of word in bits */
+#define HEX_WIDTH (BITS_IN_WORD / 4)         /* Number of hex digits for one word */
 #define HEX_OFFSET 10       /* Shift for letters in hex */
-#define DEC_DIVISOR 10      /* Constant for division */
+#define HEX_DIGITS "0123456789abcdef"
+#define WORD_MAX ((bi_word)-1)               /* Word with all bits set */
+#if BI_WORD_BITS == 64
+#define DEC_CHUNK 10000000000000000000ULL   /* 10^19, the largest power of ten in a word */
+#define DEC_CHUNK_DIGITS 19                 /* Decimal digits in one chunk */
+#else
+#define DEC_CHUNK 1000000000U   /* 10^9, the largest power of ten in a word */
+#define DEC_CHUNK_DIGITS 9      /* Decimal digits in one chunk */
+#endif
+#define DEC_POWERS_MAX 48       /* Size of the cached powers of ten table */
+
+#define POOL_CLASSES 24                             /* Pooled arrays of 4 .. 2^25 words */
+#define POOL_MIN_CLASS 2                            /* Smallest pooled array is 2^2 words */
+#define POOL_MAX_CACHED_BYTES (64UL * 1024 * 1024)  /* Upper bound for memory kept on free lists */
+
+/* Exponent bit lengths from which a wider sliding window pays off in bi_pow */
+#define POW_WINDOW_MAX 6
+#define POW_TABLE_MAX (1 << (POW_WINDOW_MAX - 1))
+static const size_t pow_window_bits[POW_WINDOW_MAX] = { 0, 7, 25, 81, 241, 673 };
+
+#define WRITE_BLOCK_SIZE 8192   /* Characters collected before one fwrite */
 
 /* HELP FUNCTIONS */
 
+static bi_word words_add(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn);
+static bi_word words_sub(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn);
+
 static int hex_value(char c)
 {
     if (c >= '0' && c <= '9')
@@ -53,87 +79,49 @@ static char* custom_strdup(const char* s)
     return new_str;
 }
 
-static void bi_add_into_abs(BigInt* res, const BigInt* b)
+/* Parallel work is only spawned for operands of at least this many words */
+static size_t parallel_threshold = PARALLEL_THRESHOLD;
+
+static bool parallel_worth(size_t words)
 {
-    size_t max_n;
-    uint64_t carry = 0;
-    size_t i;
-    uint32_t val_b;
-    uint64_t sum;
+    return words >= parallel_threshold && thread_pool_size() > 0;
+}
 
-    max_n = res->length;
-    if (b->length > max_n)
-    {
-        max_n = b->length;
-    }
+static bool bi_add_into_abs(BigInt* res, const BigInt* b)
+{
+    size_t rn = res->length;
+    size_t bn = b->length;
+    bi_word carry;
 
-    if (!bi_resize(res, max_n + 1)) return;
+    if (!bi_resize(res, (rn > bn ? rn : bn) + 1)) return false;
 
-    for (i = 0; i < max_n || carry; i++)
+    /* The longer operand goes first, b may be res itself */
+    if (rn >= bn)
     {
-        val_b = 0;
-
-        if (i >= res->length)
-        {
-            res->digits[i] = 0;
-            res->length = i + 1;
-        }
-
-        if (i < b->length)
-        {
-            val_b = b->digits[i];
-        }
-
-        sum = (uint64_t)res->digits[i] + val_b + carry;
-        res->digits[i] = (uint32_t)sum;
-        carry = sum >> BITS_IN_WORD;
+        carry = words_add(res->digits, res->digits, rn, b->digits, bn);
+    }
+    else
+    {
+        carry = words_add(res->digits, b->digits, bn, res->digits, rn);
+        rn = bn;
     }
+    res->digits[rn] = carry;
+    res->length = rn + (carry != 0);
     bi_normalize(res);
+    return true;
 }
 
 static void bi_sub_into_abs(BigInt* result, const BigInt* b)
 {
-    int borrow = 0;
-    size_t i, j;
-    uint64_t diff;
-
-    for (i = 0; i < b->length; i++)
-    {
-        diff = (uint64_t)result->digits[i] - b->digits[i] - borrow;
-        if (diff > result->digits[i])
-        {
-            borrow = 1;
-        }
-        else
-        {
-            borrow = 0;
-        }
-        result->digits[i] = (uint32_t)diff;
-    }
-
-    j = b->length;
-    while (borrow && j < result->length)
-    {
-        if (result->digits[j] > 0)
-        {
-            result->digits[j] -= 1;
-            borrow = 0;
-        }
-        else
-        {
-            result->digits[j] = 0xFFFFFFFF;
-            borrow = 1;
-        }
-        j++;
-    }
+    words_sub(result->digits, result->digits, result->length, b->digits, b->length);
     bi_normalize(result);
 }
 
-static void bi_add_digit_into(BigInt* res, uint32_t val)
+static void bi_add_digit_into(BigInt* res, bi_word val)
 {
-    uint64_t carry = val;
+    bi_dword carry = val;
     size_t i;
-    uint64_t sum;
+    bi_dword sum;
 
     if (val == 0) return;
 
@@ -147,25 +135,25 @@ static void bi_add_digit_into(BigInt* res, uint32_t val)
 
     for (i = 0; i < res->length && carry; i++)
     {
-        sum = (uint64_t)res->digits[i] + carry;
-        res->digits[i] = (uint32_t)sum;
+        sum = (bi_dword)res->digits[i] + carry;
+        res->digits[i] = (bi_word)sum;
         carry = sum >> BITS_IN_WORD;
     }
 
     if (carry)
     {
         if (!bi_resize(res, res->length + 1)) return;
-        res->digits[res->length] = (uint32_t)carry;
+        res->digits[res->length] = (bi_word)carry;
         res->length++;
     }
     bi_normalize(res);
 }
 
-static void bi_mul_digit_into(BigInt* res, uint32_t digit)
+static void bi_mul_digit_into(BigInt* res, bi_word digit)
 {
-    uint64_t carry = 0;
+    bi_dword carry = 0;
     size_t i;
-    uint64_t prod;
+    bi_dword prod;
 
     if (res->sign == 0 || digit == 0)
     {
@@ -179,343 +167,3261 @@ static void bi_mul_digit_into(BigInt* res, uint32_t digit)
 
     for (i = 0; i < res->length; i++)
     {
-        prod = (uint64_t)res->digits[i] * digit + carry;
-        res->digits[i] = (uint32_t)prod;
+        prod = (bi_dword)res->digits[i] * digit + carry;
+        res->digits[i] = (bi_word)prod;
         carry = prod >> BITS_IN_WORD;
     }
 
     if (carry)
     {
-        res->digits[res->length] = (uint32_t)carry;
+        res->digits[res->length] = (bi_word)carry;
         res->length++;
     }
     bi_normalize(res);
 }
 
-static uint32_t bi_div10_into(BigInt* res)
-{
-    uint64_t remainder = 0;
-    uint64_t current;
-    int i;
+/* WORD ARRAY KERNELS */
 
-    if (res->sign == 0) return 0;
+/*
+ * The multiplication tiers below work on raw little-endian word arrays
+ * instead of BigInt structures, so the recursion does not allocate.
+ * Unless stated otherwise the result array must not overlap the operands.
+ */
 
-    /* Iterate from MSB to LSB */
-    for (i = (int)res->length - 1; i >= 0; i--)
+static size_t words_length(const bi_word* a, size_t n)
+{
+    while (n > 0 && a[n - 1] == 0)
     {
-        current = (uint64_t)res->digits[i] + (remainder << BITS_IN_WORD);
-        res->digits[i] = (uint32_t)(current / DEC_DIVISOR);
-        remainder = current % DEC_DIVISOR;
+        n--;
     }
+    return n;
+}
 
-    bi_normalize(res);
-    return (uint32_t)remainder;
+/*
+ * Carry chains on x86-64 with 64-bit words are written in assembly: adc/sbb
+ * ripple the carry through the flags, and the multiply-accumulate row uses
+ * mulx with the two independent carry flags of adcx/adox when the CPU has
+ * BMI2 and ADX (checked at run time). Elsewhere the portable loops are used.
+ */
+#if BI_WORD_BITS == 64 && defined(__x86_64__) && defined(__GNUC__) && !defined(BI_NO_ASM)
+#define WORDS_X86_ASM 1
+#endif
+
+#ifdef WORDS_X86_ASM
+/* r = a + b for n words in blocks of four, r may alias a or b. Returns carry. */
+static bi_word words_add_n_asm(bi_word* r, const bi_word* a, const bi_word* b, size_t n)
+{
+    bi_word t;
+    size_t blocks = n / 4;
+    size_t rest = n % 4;
+
+    __asm__ ("xorl %k[t], %k[t]\n\t"
+             "1:\n\t"
+             "jrcxz 2f\n\t"
+             "movq (%[a]), %[t]\n\t"
+             "adcq (%[b]), %[t]\n\t"
+             "movq %[t], (%[r])\n\t"
+             "movq 8(%[a]), %[t]\n\t"
+             "adcq 8(%[b]), %[t]\n\t"
+             "movq %[t], 8(%[r])\n\t"
+             "movq 16(%[a]), %[t]\n\t"
+             "adcq 16(%[b]), %[t]\n\t"
+             "movq %[t], 16(%[r])\n\t"
+             "movq 24(%[a]), %[t]\n\t"
+             "adcq 24(%[b]), %[t]\n\t"
+             "movq %[t], 24(%[r])\n\t"
+             "leaq 32(%[a]), %[a]\n\t"
+             "leaq 32(%[b]), %[b]\n\t"
+             "leaq 32(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 1b\n\t"
+             "2:\n\t"
+             "movq %[rest], %[n]\n\t"
+             "3:\n\t"
+             "jrcxz 4f\n\t"
+             "movq (%[a]), %[t]\n\t"
+             "adcq (%[b]), %[t]\n\t"
+             "movq %[t], (%[r])\n\t"
+             "leaq 8(%[a]), %[a]\n\t"
+             "leaq 8(%[b]), %[b]\n\t"
+             "leaq 8(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 3b\n\t"
+             "4:\n\t"
+             "sbbq %[t], %[t]"
+             : [t] "=&r" (t), [r] "+r" (r), [a] "+r" (a), [b] "+r" (b), [n] "+c" (blocks)
+             : [rest] "r" (rest)
+             : "cc", "memory");
+    return t & 1;
 }
 
-/* CORE FUNCTIONS */
+/* r = a - b for n words in blocks of four, r may alias a or b. Returns borrow. */
+static bi_word words_sub_n_asm(bi_word* r, const bi_word* a, const bi_word* b, size_t n)
+{
+    bi_word t;
+    size_t blocks = n / 4;
+    size_t rest = n % 4;
+
+    __asm__ ("xorl %k[t], %k[t]\n\t"
+             "1:\n\t"
+             "jrcxz 2f\n\t"
+             "movq (%[a]), %[t]\n\t"
+             "sbbq (%[b]), %[t]\n\t"
+             "movq %[t], (%[r])\n\t"
+             "movq 8(%[a]), %[t]\n\t"
+             "sbbq 8(%[b]), %[t]\n\t"
+             "movq %[t], 8(%[r])\n\t"
+             "movq 16(%[a]), %[t]\n\t"
+             "sbbq 16(%[b]), %[t]\n\t"
+             "movq %[t], 16(%[r])\n\t"
+             "movq 24(%[a]), %[t]\n\t"
+             "sbbq 24(%[b]), %[t]\n\t"
+             "movq %[t], 24(%[r])\n\t"
+             "leaq 32(%[a]), %[a]\n\t"
+             "leaq 32(%[b]), %[b]\n\t"
+             "leaq 32(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 1b\n\t"
+             "2:\n\t"
+             "movq %[rest], %[n]\n\t"
+             "3:\n\t"
+             "jrcxz 4f\n\t"
+             "movq (%[a]), %[t]\n\t"
+             "sbbq (%[b]), %[t]\n\t"
+             "movq %[t], (%[r])\n\t"
+             "leaq 8(%[a]), %[a]\n\t"
+             "leaq 8(%[b]), %[b]\n\t"
+             "leaq 8(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 3b\n\t"
+             "4:\n\t"
+             "sbbq %[t], %[t]"
+             : [t] "=&r" (t), [r] "+r" (r), [a] "+r" (a), [b] "+r" (b), [n] "+c" (blocks)
+             : [rest] "r" (rest)
+             : "cc", "memory");
+    return t & 1;
+}
 
-BigInt* bi_create()
+/*
+ * r[0..n) += a[0..n) * d with mulx. The high half of the previous
+ * product enters through the CF chain (adcx) and r[i] through the OF chain
+ * (adox), so both additions of a word are independent.
+ */
+static bi_word words_addmul_1_adx(bi_word* r, const bi_word* a, size_t n, bi_word d)
 {
-    BigInt* num = (BigInt*)malloc(sizeof(BigInt));
+    bi_word carry = 0;
+    bi_word lo, hi;
+    size_t blocks = n / 4;
+    size_t rest = n % 4;
+
+    /* Blocks of four words first, then the remaining words one by one */
+    __asm__ ("xorl %k[lo], %k[lo]\n\t"
+             "1:\n\t"
+             "jrcxz 2f\n\t"
+             "mulxq (%[a]), %[lo], %[hi]\n\t"
+             "adcxq %[carry], %[lo]\n\t"
+             "adoxq (%[r]), %[lo]\n\t"
+             "movq %[lo], (%[r])\n\t"
+             "movq %[hi], %[carry]\n\t"
+             "mulxq 8(%[a]), %[lo], %[hi]\n\t"
+             "adcxq %[carry], %[lo]\n\t"
+             "adoxq 8(%[r]), %[lo]\n\t"
+             "movq %[lo], 8(%[r])\n\t"
+             "movq %[hi], %[carry]\n\t"
+             "mulxq 16(%[a]), %[lo], %[hi]\n\t"
+             "adcxq %[carry], %[lo]\n\t"
+             "adoxq 16(%[r]), %[lo]\n\t"
+             "movq %[lo], 16(%[r])\n\t"
+             "movq %[hi], %[carry]\n\t"
+             "mulxq 24(%[a]), %[lo], %[hi]\n\t"
+             "adcxq %[carry], %[lo]\n\t"
+             "adoxq 24(%[r]), %[lo]\n\t"
+             "movq %[lo], 24(%[r])\n\t"
+             "movq %[hi], %[carry]\n\t"
+             "leaq 32(%[a]), %[a]\n\t"
+             "leaq 32(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 1b\n\t"
+             "2:\n\t"
+             "movq %[rest], %[n]\n\t"
+             "3:\n\t"
+             "jrcxz 4f\n\t"
+             "mulxq (%[a]), %[lo], %[hi]\n\t"
+             "adcxq %[carry], %[lo]\n\t"
+             "adoxq (%[r]), %[lo]\n\t"
+             "movq %[lo], (%[r])\n\t"
+             "movq %[hi], %[carry]\n\t"
+             "leaq 8(%[a]), %[a]\n\t"
+             "leaq 8(%[r]), %[r]\n\t"
+             "leaq -1(%[n]), %[n]\n\t"
+             "jmp 3b\n\t"
+             "4:\n\t"
+             "movl $0, %k[lo]\n\t"
+             "adcxq %[lo], %[carry]\n\t"
+             "adoxq %[lo], %[carry]"
+             : [carry] "+&r" (carry), [lo] "=&r" (lo), [hi] "=&r" (hi),
+               [r] "+r" (r), [a] "+r" (a), [n] "+c" (blocks)
+             : [rest] "r" (rest), "d" (d)
+             : "cc", "memory");
+    return carry;
+}
 
-    if (!num)
-    {
-        return NULL;
-    }
+static bool cpu_has_adx(void)
+{
+    return __builtin_cpu_supports("adx") && __builtin_cpu_supports("bmi2");
+}
+#endif
 
-    num->digits = (uint32_t*)calloc(INITIAL_CAPACITY, sizeof(uint32_t));
+/* r = a + b for an >= bn, r has an words and may alias a. Returns carry. */
+static bi_word words_add(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn)
+{
+    bi_dword carry = 0;
+    bi_dword sum;
+    size_t i = 0;
 
-    if (!num->digits)
+#ifdef WORDS_X86_ASM
+    if (bn > 0)
     {
-        free(num);
-        return NULL;
+        carry = words_add_n_asm(r, a, b, bn);
+        i = bn;
     }
-
-    memset(num->digits, 0, INITIAL_CAPACITY * sizeof(uint32_t));
-
-    num->sign = 0;
-    num->length = 1;
-    num->capacity = INITIAL_CAPACITY;
-    num->digits[0] = 0;
-
-    return num;
+#endif
+    for (; i < bn; i++)
+    {
+        sum = (bi_dword)a[i] + b[i] + carry;
+        r[i] = (bi_word)sum;
+        carry = sum >> BITS_IN_WORD;
+    }
+    for (; i < an && carry; i++)
+    {
+        sum = (bi_dword)a[i] + carry;
+        r[i] = (bi_word)sum;
+        carry = sum >> BITS_IN_WORD;
+    }
+    if (r != a && i < an)
+    {
+        memcpy(r + i, a + i, (an - i) * sizeof(bi_word));
+    }
+    return (bi_word)carry;
 }
 
-void bi_destroy(BigInt* num)
+/* r = a - b for an >= bn, r has an words and may alias a. Returns borrow. */
+static bi_word words_sub(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn)
 {
-    if (!num) return;
+    bi_word borrow = 0;
+    bi_dword diff;
+    size_t i = 0;
 
-    if (num->digits != NULL)
+#ifdef WORDS_X86_ASM
+    if (bn > 0)
     {
-        free(num->digits);
+        borrow = words_sub_n_asm(r, a, b, bn);
+        i = bn;
     }
-    free(num);
+#endif
+    for (; i < bn; i++)
+    {
+        diff = (bi_dword)a[i] - b[i] - borrow;
+        r[i] = (bi_word)diff;
+        borrow = (bi_word)(diff >> BITS_IN_WORD) & 1U;
+    }
+    for (; i < an && borrow; i++)
+    {
+        diff = (bi_dword)a[i] - borrow;
+        r[i] = (bi_word)diff;
+        borrow = (bi_word)(diff >> BITS_IN_WORD) & 1U;
+    }
+    if (r != a && i < an)
+    {
+        memcpy(r + i, a + i, (an - i) * sizeof(bi_word));
+    }
+    return borrow;
 }
 
-BigInt* bi_copy(const BigInt* original)
+/* r[0..n) += a[0..n) * d. Returns the carry word. */
+static bi_word words_addmul_1(bi_word* r, const bi_word* a, size_t n, bi_word d)
 {
-    BigInt* copy;
+    bi_dword carry = 0;
+    bi_dword current;
+    size_t i;
 
-    if (!original || !original->digits || original->capacity == 0)
+#ifdef WORDS_X86_ASM
+    if (cpu_has_adx()) return words_addmul_1_adx(r, a, n, d);
+#endif
+    for (i = 0; i < n; i++)
     {
-        return NULL;
+        current = (bi_dword)a[i] * d + r[i] + carry;
+        r[i] = (bi_word)current;
+        carry = current >> BITS_IN_WORD;
     }
+    return (bi_word)carry;
+}
 
-    copy = (BigInt*)malloc(sizeof(BigInt));
-    if (!copy) return NULL;
+static int word_leading_zeros(bi_word w)
+{
+    int n = 0;
 
-    copy->digits = (uint32_t*)malloc(original->capacity * sizeof(uint32_t));
-    if (!copy->digits)
+    if (w == 0) return BITS_IN_WORD;
+    while (!(w & ((bi_word)1 << (BITS_IN_WORD - 1))))
     {
-        free(copy);
-        return NULL;
+        w <<= 1;
+        n++;
     }
-
-    memcpy(copy->digits, original->digits, original->length * sizeof(uint32_t));
-
-    copy->sign = original->sign;
-    copy->length = original->length;
-    copy->capacity = original->capacity;
-
-    return copy;
+    return n;
 }
 
-bool bi_resize(BigInt* num, size_t required_capacity)
+/* r = a << bits for bits < BITS_IN_WORD, r may alias a. Returns the bits shifted out. */
+static bi_word words_shl(bi_word* r, const bi_word* a, size_t n, unsigned int bits)
 {
-    size_t old_capacity;
-    uint32_t* new_digits;
-
-    if (!num) return false;
+    bi_word out = 0;
+    bi_word w;
+    size_t i;
 
-    if (num->capacity >= required_capacity)
+    if (bits == 0)
     {
-        return true;
+        memmove(r, a, n * sizeof(bi_word));
+        return 0;
     }
-
-    old_capacity = num->capacity;
-    new_digits = realloc(num->digits, required_capacity * sizeof(uint32_t));
-
-    if (!new_digits)
+    for (i = 0; i < n; i++)
     {
-        return false;
+        w = a[i];
+        r[i] = (w << bits) | out;
+        out = w >> (BITS_IN_WORD - bits);
     }
-
-    memset(new_digits + old_capacity, 0, (required_capacity - old_capacity) * sizeof(uint32_t));
-
-    num->digits = new_digits;
-    num->capacity = required_capacity;
-    return true;
+    return out;
 }
 
-void bi_normalize(BigInt* num)
+/* r = a >> bits for bits < BITS_IN_WORD, r may alias a. */
+static void words_shr(bi_word* r, const bi_word* a, size_t n, unsigned int bits)
 {
-    if (!num) return;
-    if (!num->digits) return;
+    size_t i;
 
-    /* Deleting null words */
-    while (num->length > 1 && num->digits[num->length - 1] == 0)
+    if (bits == 0)
     {
-        num->length--;
+        memmove(r, a, n * sizeof(bi_word));
+        return;
     }
-
-    if (num->length == 1 && num->digits[0] == 0)
+    for (i = 0; i < n; i++)
     {
-        num->sign = 0;
+        r[i] = a[i] >> bits;
+        if (i + 1 < n) r[i] |= a[i + 1] << (BITS_IN_WORD - bits);
     }
 }
 
-/* HELP MATH FUNCTIONS */
-
-int bi_compare_abs(const BigInt* a, const BigInt* b)
+/* q = a / d for a single word divisor, q may alias a. Returns the remainder. */
+static bi_word words_divmod_1(bi_word* q, const bi_word* a, size_t n, bi_word d)
 {
+    bi_dword remainder = 0;
+    bi_dword current;
     size_t i;
 
-    if (!a || !b) return 0;
-
-    if (a->length > b->length) return 1;
-    if (a->length < b->length) return -1;
-
-    for (i = a->length; i > 0; i--)
+    for (i = n; i > 0; i--)
     {
-        if (a->digits[i - 1] > b->digits[i - 1]) return 1;
-        if (a->digits[i - 1] < b->digits[i - 1]) return -1;
+        current = (bi_dword)a[i - 1] | (remainder << BITS_IN_WORD);
+        q[i - 1] = (bi_word)(current / d);
+        remainder = current % d;
     }
-
-    return 0;
+    return (bi_word)remainder;
 }
 
-int bi_get_bit(const BigInt* n, size_t k)
+/* a mod d for a single word divisor, without building the quotient */
+static bi_word words_mod_1(const bi_word* a, size_t n, bi_word d)
 {
-    if (!n) return 0;
-
-    size_t digit_idx = k / BITS_IN_WORD;
-    size_t bit_idx = k % BITS_IN_WORD;
+    bi_dword remainder = 0;
+    size_t i;
 
-    if (digit_idx < n->length) {
-        uint32_t digit = n->digits[digit_idx];
-        return (int)((digit >> bit_idx) & 1U);
+    for (i = n; i > 0; i--)
+    {
+        remainder = ((bi_dword)a[i - 1] | (remainder << BITS_IN_WORD)) % d;
     }
-
-    return 0;
+    return (bi_word)remainder;
 }
 
-size_t bi_bit_length(const BigInt* n)
+/* r[0..n) -= a[0..n) * d. Returns the borrow word. */
+static bi_word words_submul_1(bi_word* r, const bi_word* a, size_t n, bi_word d)
 {
-    size_t bits;
-    uint32_t last_digit;
-
-    if (!n) return 0;
-    if (n->sign == 0) return 0;
-
-    bits = (n->length - 1) * BITS_IN_WORD;
-    last_digit = n->digits[n->length - 1];
+    bi_dword carry = 0;
+    bi_dword prod;
+    bi_word lo;
+    size_t i;
 
-    while (last_digit > 0)
+    for (i = 0; i < n; i++)
     {
-        last_digit >>= 1;
-        bits++;
+        prod = (bi_dword)a[i] * d + carry;
+        lo = (bi_word)prod;
+        carry = prod >> BITS_IN_WORD;
+        if (r[i] < lo) carry++;
+        r[i] -= lo;
     }
-    return bits;
+    return (bi_word)carry;
 }
 
-void bi_shift_left_one(BigInt* n)
+/* Schoolbook product, r has an + bn words. */
+static void words_mul_basecase(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn)
 {
     size_t i;
-    uint32_t carry = 0;
-    uint32_t next_carry;
-
-    if (!n) return;
-    if (n->sign == 0) return;
-    if (!bi_resize(n, n->length + 1)) return;
 
-    for (i = 0; i < n->length; i++)
-    {
-        next_carry = n->digits[i] >> 31;
-        n->digits[i] = (n->digits[i] << 1) | carry;
-        carry = next_carry;
-    }
-    if (carry)
+    memset(r, 0, (an + bn) * sizeof(bi_word));
+    for (i = 0; i < an; i++)
     {
-        n->digits[n->length] = carry;
-        n->length++;
+        r[i + bn] = words_addmul_1(r + i, b, bn, a[i]);
     }
 }
 
-/* CORE MATH FUNCTIONS */
-
-BigInt* bi_add_abs(const BigInt* a, const BigInt* b)
+/* Schoolbook square, every cross product is computed only once. r has 2n words. */
+static void words_sqr_basecase(bi_word* r, const bi_word* a, size_t n)
 {
-    BigInt* res = NULL;
-    const BigInt* smaller = NULL;
-
-    if (!a || !b) return NULL;
+    size_t i;
+    bi_dword carry = 0;
+    bi_dword sq;
+    bi_dword sum;
+    bi_word top;
 
-    if (bi_compare_abs(a, b) >= 0)
+    memset(r, 0, 2 * n * sizeof(bi_word));
+    for (i = 0; i + 1 < n; i++)
     {
-        res = bi_copy(a);
-        smaller = b;
+        r[i + n] = words_addmul_1(r + 2 * i + 1, a + i + 1, n - i - 1, a[i]);
     }
-    else
+
+    /* Double the cross products */
+    top = 0;
+    for (i = 0; i < 2 * n; i++)
     {
-        res = bi_copy(b);
-        smaller = a;
+        bi_word next_top = r[i] >> (BITS_IN_WORD - 1);
+        r[i] = (r[i] << 1) | top;
+        top = next_top;
     }
 
-    if (!res) return NULL;
-
-    bi_add_into_abs(res, smaller);
-    return res;
+    /* Add the diagonal */
+    for (i = 0; i < n; i++)
+    {
+        sq = (bi_dword)a[i] * a[i];
+        sum = (bi_dword)r[2 * i] + (bi_word)sq + carry;
+        r[2 * i] = (bi_word)sum;
+        carry = sum >> BITS_IN_WORD;
+        sum = (bi_dword)r[2 * i + 1] + (sq >> BITS_IN_WORD) + carry;
+        r[2 * i + 1] = (bi_word)sum;
+        carry = sum >> BITS_IN_WORD;
+    }
 }
 
-BigInt* bi_sub_abs(const BigInt* a, const BigInt* b)
+/* Scratch words needed by words_karatsuba() for operands of n words */
+static size_t karatsuba_scratch_size(size_t n, size_t threshold)
 {
-    BigInt* result;
-
-    if (!a || !b) return NULL;
-
-    result = bi_copy(a);
-    if (!result) return NULL;
+    size_t total = 0;
+    size_t m;
 
-    bi_sub_into_abs(result, b);
-    return result;
+    while (n >= threshold)
+    {
+        m = n - n / 2 + 1;
+        total += 4 * m;
+        n = m;
+    }
+    return total;
 }
 
-void bi_div_mod_abs(const BigInt* a, const BigInt* b, BigInt** quotient, BigInt** remainder)
+/*
+ * Karatsuba product of two n-word operands into r (2n words).
+ * With a = a1*B^h + a0 and b = b1*B^h + b0:
+ * a*b = z2*B^2h + ((a0 + a1)(b0 + b1) - z0 - z2)*B^h + z0
+ */
+static void words_karatsuba(bi_word* r, const bi_word* a, const bi_word* b, size_t n, bi_word* scratch)
 {
-    BigInt* q;
-    BigInt* r;
-    size_t bits;
-    int i;
+    size_t h, m, m1, tn;
+    bi_word* sa;
+    bi_word* sb;
+    bi_word* t;
+    bi_word* next;
 
-    if (!a || !b || b->sign == 0)
+    if (n < KARATSUBA_THRESHOLD)
     {
-        *quotient = NULL;
-        *remainder = NULL;
+        words_mul_basecase(r, a, n, b, n);
         return;
     }
 
-    if (bi_compare_abs(a, b) < 0)
+    h = n / 2;
+    m = n - h;
+    m1 = m + 1;
+    sa = scratch;
+    sb = sa + m1;
+    t = sb + m1;
+    next = t + 2 * m1;
+
+    sa[m] = words_add(sa, a + h, m, a, h);
+    sb[m] = words_add(sb, b + h, m, b, h);
+    words_karatsuba(t, sa, sb, m1, next);
+    words_karatsuba(r, a, b, h, next);
+    words_karatsuba(r + 2 * h, a + h, b + h, m, next);
+
+    words_sub(t, t, 2 * m1, r, 2 * h);
+    words_sub(t, t, 2 * m1, r + 2 * h, 2 * m);
+
+    /* The middle term fits into the product, its top words are zero */
+    tn = words_length(t, 2 * m1);
+    words_add(r + h, r + h, 2 * n - h, t, tn);
+}
+
+/* Karatsuba square of an n-word operand into r (2n words). */
+static void words_karatsuba_sqr(bi_word* r, const bi_word* a, size_t n, bi_word* scratch)
+{
+    size_t h, m, m1, tn;
+    bi_word* sa;
+    bi_word* t;
+    bi_word* next;
+
+    if (n < KARATSUBA_SQR_THRESHOLD)
     {
-        *quotient = bi_create();
-        *remainder = bi_copy(a);
+        words_sqr_basecase(r, a, n);
         return;
     }
 
-    q = bi_create();
-    r = bi_create();
-    if (!q || !r) { return; }
-
-    bits = bi_bit_length(a);
+    h = n / 2;
+    m = n - h;
+    m1 = m + 1;
+    sa = scratch;
+    t = sa + 2 * m1;
+    next = t + 2 * m1;
 
-    for (i = (int)bits - 1; i >= 0; i--)
-    {
-        bi_shift_left_one(r);
-        if (bi_get_bit(a, i))
-        {
-            r->digits[0] |= 1;
-            r->sign = 1;
-        }
-        bi_normalize(r);
+    sa[m] = words_add(sa, a + h, m, a, h);
+    words_karatsuba_sqr(t, sa, m1, next);
+    words_karatsuba_sqr(r, a, h, next);
+    words_karatsuba_sqr(r + 2 * h, a + h, m, next);
 
-        if (bi_compare_abs(r, b) >= 0)
-        {
-            bi_sub_into_abs(r, b);
+    words_sub(t, t, 2 * m1, r, 2 * h);
+    words_sub(t, t, 2 * m1, r + 2 * h, 2 * m);
 
-            if (!bi_resize(q, (i / BITS_IN_WORD) + 1))
-            {
-                bi_destroy(q);
-                bi_destroy(r);
-                *quotient = NULL;
-                *remainder = NULL;
-                return;
-            }
-            q->digits[i / BITS_IN_WORD] |= (1U << (i % BITS_IN_WORD));
-            if (q->length <= (size_t)(i / BITS_IN_WORD)) q->length = (i / BITS_IN_WORD) + 1;
-            q->sign = 1;
-        }
-    }
-    bi_normalize(q);
-    *quotient = q;
-    *remainder = r;
+    tn = words_length(t, 2 * m1);
+    words_add(r + h, r + h, 2 * n - h, t, tn);
 }
 
-BigInt* bi_add(const BigInt* a, const BigInt* b)
+static BigInt* bi_from_words(const bi_word* w, size_t n)
 {
-    int cmp;
-    BigInt* result;
+    BigInt* res;
 
-    if (!a || !b) return NULL;
+    res = bi_create();
+    if (!res) return NULL;
 
-    if (a->sign == 0) return bi_copy(b);
-    if (b->sign == 0) return bi_copy(a);
+    n = words_length(w, n);
+    if (n == 0) return res;
 
-    if (a->sign == b->sign)
+    if (!bi_resize(res, n))
     {
-        result = bi_add_abs(a, b);
-        if (!result) return NULL;
-        result->sign = a->sign;
-        return result;
-    }
+        bi_destroy(res);
+        return NULL;
+    }
+    memcpy(res->digits, w, n * sizeof(bi_word));
+    res->length = n;
+    res->sign = 1;
+    return res;
+}
+
+/* Replaces old value with its successor, used to chain allocating operations */
+static BigInt* bi_replace(BigInt* old, BigInt* successor)
+{
+    bi_destroy(old);
+    return successor;
+}
+
+/* Exact in-place division of a signed BigInt by a small divisor */
+static BigInt* bi_div_exact_small(BigInt* num, bi_word divisor)
+{
+    if (!num) return NULL;
+
+    words_divmod_1(num->digits, num->digits, num->length, divisor);
+    bi_normalize(num);
+    return num;
+}
+
+/* Adds a non-negative value shifted by offset words into r (rn words) */
+static void words_add_shifted(bi_word* r, size_t rn, const BigInt* v, size_t offset)
+{
+    if (!v || v->sign == 0) return;
+    words_add(r + offset, r + offset, rn - offset, v->digits, v->length);
+}
+
+/* One product of a parallel batch, b is NULL for a square */
+typedef struct
+{
+    const BigInt* a;
+    const BigInt* b;
+    BigInt* res;
+} MulJob;
+
+static void mul_job_run(void* arg)
+{
+    MulJob* job = (MulJob*)arg;
+
+    job->res = job->b ? bi_mul(job->a, job->b) : bi_sqr(job->a);
+}
+
+/* Computes all products of jobs, in parallel if requested */
+static void mul_jobs_run(MulJob* jobs, size_t count, bool parallel)
+{
+    ThreadTask tasks[5];
+    size_t i;
+
+    if (!parallel || count > 5)
+    {
+        for (i = 0; i < count; i++) mul_job_run(&jobs[i]);
+        return;
+    }
+
+    for (i = 1; i < count; i++) thread_pool_spawn(&tasks[i], mul_job_run, &jobs[i]);
+    mul_job_run(&jobs[0]);
+    for (i = 1; i < count; i++) thread_pool_join(&tasks[i]);
+}
+
+/*
+ * Toom-Cook 3-way product of two n-word operands into r (2n words).
+ * Operands are split into three parts, evaluated at 0, 1, -1, -2 and infinity
+ * and the five products are interpolated by Bodrato's sequence. The signed
+ * intermediate values are kept in BigInts, which is cheap at this size.
+ * The five products are independent and run in parallel for huge operands.
+ * If b is NULL, a is squared.
+ */
+static bool words_toom3(bi_word* r, const bi_word* a, const bi_word* b, size_t n)
+{
+    size_t k = (n + 2) / 3;
+    bool square = (b == NULL);
+    bool ok;
+    BigInt *a0, *a1, *a2, *b0, *b1, *b2;
+    BigInt *pa, *pb, *a_1, *b_1, *a_m1, *b_m1, *a_m2, *b_m2;
+    BigInt *v0, *v1, *vm1, *vm2, *vinf;
+    BigInt *r1, *r2, *r3;
+    MulJob jobs[5];
+
+    a0 = bi_from_words(a, k);
+    a1 = bi_from_words(a + k, k);
+    a2 = bi_from_words(a + 2 * k, n - 2 * k);
+
+    /* Evaluation: p = a0 + a2, a(1) = p + a1, a(-1) = p - a1, a(-2) = 2(a(-1) + a2) - a0 */
+    pa = bi_add(a0, a2);
+    a_1 = bi_add(pa, a1);
+    a_m1 = bi_sub(pa, a1);
+    a_m2 = bi_add(a_m1, a2);
+    a_m2 = bi_replace(a_m2, bi_add(a_m2, a_m2));
+    a_m2 = bi_replace(a_m2, bi_sub(a_m2, a0));
+
+    if (square)
+    {
+        b0 = b1 = b2 = pb = b_1 = b_m1 = b_m2 = NULL;
+    }
+    else
+    {
+        b0 = bi_from_words(b, k);
+        b1 = bi_from_words(b + k, k);
+        b2 = bi_from_words(b + 2 * k, n - 2 * k);
+        pb = bi_add(b0, b2);
+        b_1 = bi_add(pb, b1);
+        b_m1 = bi_sub(pb, b1);
+        b_m2 = bi_add(b_m1, b2);
+        b_m2 = bi_replace(b_m2, bi_add(b_m2, b_m2));
+        b_m2 = bi_replace(b_m2, bi_sub(b_m2, b0));
+    }
+
+    /* A missing operand would turn a product into a square, skip those */
+    jobs[0].a = a0; jobs[0].b = b0;
+    jobs[1].a = a_1; jobs[1].b = b_1;
+    jobs[2].a = a_m1; jobs[2].b = b_m1;
+    jobs[3].a = a_m2; jobs[3].b = b_m2;
+    jobs[4].a = a2; jobs[4].b = b2;
+    ok = a0 && a_1 && a_m1 && a_m2 && a2 && (square || (b0 && b_1 && b_m1 && b_m2 && b2));
+    if (ok)
+    {
+        mul_jobs_run(jobs, 5, parallel_worth(n));
+    }
+    else
+    {
+        jobs[0].res = jobs[1].res = jobs[2].res = jobs[3].res = jobs[4].res = NULL;
+    }
+    v0 = jobs[0].res;
+    v1 = jobs[1].res;
+    vm1 = jobs[2].res;
+    vm2 = jobs[3].res;
+    vinf = jobs[4].res;
+
+    /* Interpolation */
+    r3 = bi_div_exact_small(bi_sub(vm2, v1), 3);
+    r1 = bi_div_exact_small(bi_sub(v1, vm1), 2);
+    r2 = bi_sub(vm1, v0);
+    r3 = bi_replace(r3, bi_div_exact_small(bi_sub(r2, r3), 2));
+    r3 = bi_replace(r3, bi_add(r3, vinf));
+    r3 = bi_replace(r3, bi_add(r3, vinf));
+    r2 = bi_replace(r2, bi_add(r2, r1));
+    r2 = bi_replace(r2, bi_sub(r2, vinf));
+    r1 = bi_replace(r1, bi_sub(r1, r3));
+
+    ok = v0 && r1 && r2 && r3 && vinf;
+    if (ok)
+    {
+        memset(r, 0, 2 * n * sizeof(bi_word));
+        words_add_shifted(r, 2 * n, v0, 0);
+        words_add_shifted(r, 2 * n, r1, k);
+        words_add_shifted(r, 2 * n, r2, 2 * k);
+        words_add_shifted(r, 2 * n, r3, 3 * k);
+        words_add_shifted(r, 2 * n, vinf, 4 * k);
+    }
+
+    bi_destroy(a0); bi_destroy(a1); bi_destroy(a2);
+    bi_destroy(b0); bi_destroy(b1); bi_destroy(b2);
+    bi_destroy(pa); bi_destroy(a_1); bi_destroy(a_m1); bi_destroy(a_m2);
+    bi_destroy(pb); bi_destroy(b_1); bi_destroy(b_m1); bi_destroy(b_m2);
+    bi_destroy(v0); bi_destroy(v1); bi_destroy(vm1); bi_destroy(vm2); bi_destroy(vinf);
+    bi_destroy(r1); bi_destroy(r2); bi_destroy(r3);
+    return ok;
+}
+
+/* NUMBER THEORETIC TRANSFORM */
+
+/*
+ * Products of huge operands are computed as a convolution of 32-bit chunks
+ * modulo three NTT friendly primes below 2^31, recombined by the Chinese
+ * remainder theorem. A convolution coefficient is below 2^25 * 2^64 for any
+ * length the transform supports (2^26) while the primes multiply to about
+ * 2^90, so the result is exact. Arithmetic modulo p uses Montgomery reduction
+ * with R = 2^32; twiddle factors are stored in Montgomery form so that
+ * multiplying a plain residue by them yields a plain residue again.
+ */
+
+#define NTT_CHUNK_BITS 32                                  /* Bits of one convolution coefficient */
+#define NTT_CHUNKS_PER_WORD (BITS_IN_WORD / NTT_CHUNK_BITS)
+#define NTT_MONT_BITS 32                                   /* Montgomery radix R = 2^32 */
+#define NTT_MAX_LOG 26                                     /* All three primes have 2^26 | p - 1 */
+#define NTT_PRIMES 3
+
+typedef struct
+{
+    uint32_t p;      /* The prime */
+    uint32_t g;      /* Primitive root modulo p */
+    uint32_t p_inv;  /* -p^(-1) mod 2^32 */
+    uint32_t r2;     /* 2^64 mod p */
+} NttPrime;
+
+static const uint32_t ntt_moduli[NTT_PRIMES] = { 2013265921U, 1811939329U, 469762049U };
+static const uint32_t ntt_roots[NTT_PRIMES] = { 31, 13, 3 };
+
+static uint32_t ntt_pow(uint32_t base, uint64_t e, uint32_t p)
+{
+    uint64_t result = 1;
+    uint64_t b = base % p;
+
+    while (e)
+    {
+        if (e & 1) result = result * b % p;
+        b = b * b % p;
+        e >>= 1;
+    }
+    return (uint32_t)result;
+}
+
+static void ntt_prime_init(NttPrime* prime, int index)
+{
+    uint32_t inv = 1;
+    int i;
+    uint64_t r;
+
+    prime->p = ntt_moduli[index];
+    prime->g = ntt_roots[index];
+
+    /* Newton iteration for p^(-1) mod 2^32 */
+    for (i = 0; i < 5; i++)
+    {
+        inv *= 2 - prime->p * inv;
+    }
+    prime->p_inv = (uint32_t)(0U - inv);
+
+    r = ((uint64_t)1 << NTT_MONT_BITS) % prime->p;
+    prime->r2 = (uint32_t)(r * r % prime->p);
+}
+
+static uint32_t ntt_mont_mul(uint32_t a, uint32_t b, const NttPrime* prime)
+{
+    uint64_t t = (uint64_t)a * b;
+    uint32_t m = (uint32_t)t * prime->p_inv;
+    uint32_t res = (uint32_t)((t + (uint64_t)m * prime->p) >> NTT_MONT_BITS);
+
+    return res >= prime->p ? res - prime->p : res;
+}
+
+static uint32_t ntt_to_mont(uint32_t a, const NttPrime* prime)
+{
+    return ntt_mont_mul(a, prime->r2, prime);
+}
+
+/*
+ * Twiddle table for a transform of length n: for every level len the
+ * factors w^j (w of order 2len, j < len) are stored at tw[len + j].
+ */
+static void ntt_twiddles(uint32_t* tw, size_t n, bool inverse, const NttPrime* prime)
+{
+    size_t len, j;
+    uint32_t w;
+    uint64_t cur;
+
+    for (len = 1; len < n; len <<= 1)
+    {
+        w = ntt_pow(prime->g, (prime->p - 1) / (2 * len), prime->p);
+        if (inverse) w = ntt_pow(w, prime->p - 2, prime->p);
+
+        cur = 1;
+        for (j = 0; j < len; j++)
+        {
+            tw[len + j] = ntt_to_mont((uint32_t)cur, prime);
+            cur = cur * w % prime->p;
+        }
+    }
+}
+
+/* Decimation in frequency, natural order in and bit reversed order out */
+static void ntt_forward(uint32_t* a, size_t n, const uint32_t* tw, const NttPrime* prime)
+{
+    size_t len, s, j;
+    uint32_t p = prime->p;
+    uint32_t u, v;
+
+    for (len = n >> 1; len > 0; len >>= 1)
+    {
+        for (s = 0; s < n; s += 2 * len)
+        {
+            for (j = 0; j < len; j++)
+            {
+                u = a[s + j];
+                v = a[s + j + len];
+                a[s + j] = u + v >= p ? u + v - p : u + v;
+                a[s + j + len] = ntt_mont_mul(u >= v ? u - v : u + p - v, tw[len + j], prime);
+            }
+        }
+    }
+}
+
+/* Decimation in time, bit reversed order in and natural order out, not scaled */
+static void ntt_inverse(uint32_t* a, size_t n, const uint32_t* tw, const NttPrime* prime)
+{
+    size_t len, s, j;
+    uint32_t p = prime->p;
+    uint32_t u, v;
+
+    for (len = 1; len < n; len <<= 1)
+    {
+        for (s = 0; s < n; s += 2 * len)
+        {
+            for (j = 0; j < len; j++)
+            {
+                u = a[s + j];
+                v = ntt_mont_mul(a[s + j + len], tw[len + j], prime);
+                a[s + j] = u + v >= p ? u + v - p : u + v;
+                a[s + j + len] = u >= v ? u - v : u + p - v;
+            }
+        }
+    }
+}
+
+static void ntt_load(uint32_t* dst, size_t n, const bi_word* a, size_t an, const NttPrime* prime)
+{
+    uint64_t mask = ((uint64_t)1 << NTT_CHUNK_BITS) - 1;
+    size_t i;
+    int c;
+
+    for (i = 0; i < an; i++)
+    {
+        for (c = 0; c < NTT_CHUNKS_PER_WORD; c++)
+        {
+            dst[i * NTT_CHUNKS_PER_WORD + c] = (uint32_t)(((a[i] >> (c * NTT_CHUNK_BITS)) & mask) % prime->p);
+        }
+    }
+    memset(dst + an * NTT_CHUNKS_PER_WORD, 0, (n - an * NTT_CHUNKS_PER_WORD) * sizeof(uint32_t));
+}
+
+/* Cyclic convolution of a and b (or a with itself if b is NULL) modulo one prime */
+static bool ntt_convolve(uint32_t* res, size_t n, const bi_word* a, size_t an,
+                         const bi_word* b, size_t bn, const NttPrime* prime)
+{
+    uint32_t* tw;
+    uint32_t* fb = NULL;
+    uint32_t scale;
+    size_t i;
+
+    tw = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (!tw) return false;
+    if (b)
+    {
+        fb = (uint32_t*)malloc(n * sizeof(uint32_t));
+        if (!fb)
+        {
+            free(tw);
+            return false;
+        }
+    }
+
+    ntt_twiddles(tw, n, false, prime);
+    ntt_load(res, n, a, an, prime);
+    ntt_forward(res, n, tw, prime);
+    if (fb)
+    {
+        ntt_load(fb, n, b, bn, prime);
+        ntt_forward(fb, n, tw, prime);
+        for (i = 0; i < n; i++) res[i] = ntt_mont_mul(res[i], fb[i], prime);
+    }
+    else
+    {
+        for (i = 0; i < n; i++) res[i] = ntt_mont_mul(res[i], res[i], prime);
+    }
+
+    /* Pointwise products carry a factor R^(-1), the scale adds n^(-1) * R back */
+    ntt_twiddles(tw, n, true, prime);
+    ntt_inverse(res, n, tw, prime);
+    scale = ntt_mont_mul(ntt_pow((uint32_t)(n % prime->p), prime->p - 2, prime->p), prime->r2, prime);
+    scale = ntt_mont_mul(scale, prime->r2, prime);
+    for (i = 0; i < n; i++) res[i] = ntt_mont_mul(res[i], scale, prime);
+
+    free(tw);
+    free(fb);
+    return true;
+}
+
+/*
+ * Garner recombination of the three residues of each coefficient and carry
+ * propagation of the chunks into r (rn words).
+ */
+static void ntt_recombine(bi_word* r, size_t rn, uint32_t* const res[NTT_PRIMES])
+{
+    uint64_t p0 = ntt_moduli[0];
+    uint64_t p1 = ntt_moduli[1];
+    uint64_t p2 = ntt_moduli[2];
+    uint64_t p01 = p0 * p1;
+    uint64_t inv_p0 = ntt_pow((uint32_t)(p0 % p1), p1 - 2, (uint32_t)p1);
+    uint64_t inv_p01 = ntt_pow((uint32_t)(p01 % p2), p2 - 2, (uint32_t)p2);
+    uint64_t acc_lo = 0;   /* Pending carry, 128 bits wide */
+    uint64_t acc_hi = 0;
+    uint64_t mask = ((uint64_t)1 << NTT_CHUNK_BITS) - 1;
+    uint64_t x, t, lo, hi, prod_lo, prod_hi;
+    size_t i, total = rn * NTT_CHUNKS_PER_WORD;
+
+    memset(r, 0, rn * sizeof(bi_word));
+    for (i = 0; i < total; i++)
+    {
+        /* x = r0 + p0 * ((r1 - r0) / p0 mod p1) */
+        t = (res[1][i] + p1 - res[0][i] % p1) % p1 * inv_p0 % p1;
+        x = res[0][i] + p0 * t;
+
+        /* value = x + p0 * p1 * ((r2 - x) / (p0 * p1) mod p2) */
+        t = (res[2][i] + p2 - x % p2) % p2 * inv_p01 % p2;
+        prod_lo = (p01 & 0xFFFFFFFFU) * t;
+        prod_hi = (p01 >> 32) * t;
+        lo = prod_lo + (prod_hi << 32);
+        hi = (prod_hi >> 32) + (lo < prod_lo);
+
+        acc_lo += lo;
+        acc_hi += hi + (acc_lo < lo);
+        acc_lo += x;
+        acc_hi += (acc_lo < x);
+
+        r[i / NTT_CHUNKS_PER_WORD] |= (bi_word)(acc_lo & mask) << ((i % NTT_CHUNKS_PER_WORD) * NTT_CHUNK_BITS);
+        acc_lo = (acc_lo >> NTT_CHUNK_BITS) | (acc_hi << (64 - NTT_CHUNK_BITS));
+        acc_hi >>= NTT_CHUNK_BITS;
+    }
+}
+
+/* Transform length for a product of an + bn words, 0 if it is too long */
+static size_t ntt_length(size_t an, size_t bn)
+{
+    size_t chunks = (an + bn) * NTT_CHUNKS_PER_WORD;
+    size_t n = 1;
+
+    while (n < chunks)
+    {
+        n <<= 1;
+    }
+    return n <= ((size_t)1 << NTT_MAX_LOG) ? n : 0;
+}
+
+/* Convolution modulo one of the primes, run as a task */
+typedef struct
+{
+    uint32_t* res;
+    size_t n;
+    const bi_word* a;
+    size_t an;
+    const bi_word* b;
+    size_t bn;
+    int index;
+    bool ok;
+} NttJob;
+
+static void ntt_job_run(void* arg)
+{
+    NttJob* job = (NttJob*)arg;
+    NttPrime prime;
+
+    ntt_prime_init(&prime, job->index);
+    job->ok = ntt_convolve(job->res, job->n, job->a, job->an, job->b, job->bn, &prime);
+}
+
+/*
+ * NTT product of a and b (or square of a if b is NULL), r has an + bn words.
+ * The three convolutions are independent and run in parallel for huge operands.
+ */
+static bool words_mul_ntt(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn)
+{
+    uint32_t* res[NTT_PRIMES];
+    NttJob jobs[NTT_PRIMES];
+    ThreadTask tasks[NTT_PRIMES];
+    bool parallel;
+    size_t n;
+    int k;
+    bool ok = true;
+
+    if (!b) bn = an;
+    n = ntt_length(an, bn);
+    if (n == 0) return false;
+
+    for (k = 0; k < NTT_PRIMES; k++)
+    {
+        res[k] = ok ? (uint32_t*)malloc(n * sizeof(uint32_t)) : NULL;
+        if (!res[k]) ok = false;
+    }
+
+    if (ok)
+    {
+        parallel = parallel_worth(an + bn);
+        for (k = 0; k < NTT_PRIMES; k++)
+        {
+            jobs[k].res = res[k];
+            jobs[k].n = n;
+            jobs[k].a = a;
+            jobs[k].an = an;
+            jobs[k].b = b;
+            jobs[k].bn = bn;
+            jobs[k].index = k;
+            if (parallel && k > 0) thread_pool_spawn(&tasks[k], ntt_job_run, &jobs[k]);
+        }
+        for (k = 0; k < NTT_PRIMES; k++)
+        {
+            if (parallel && k > 0)
+            {
+                thread_pool_join(&tasks[k]);
+            }
+            else
+            {
+                ntt_job_run(&jobs[k]);
+            }
+            ok = ok && jobs[k].ok;
+        }
+    }
+    if (ok) ntt_recombine(r, an + bn, res);
+
+    for (k = 0; k < NTT_PRIMES; k++)
+    {
+        free(res[k]);
+    }
+    return ok;
+}
+
+/* Product of two n-word operands, picks the tier by size */
+static bool words_mul_n(bi_word* r, const bi_word* a, const bi_word* b, size_t n)
+{
+    bi_word* scratch;
+
+    if (n < KARATSUBA_THRESHOLD)
+    {
+        words_mul_basecase(r, a, n, b, n);
+        return true;
+    }
+    if (n >= NTT_THRESHOLD && ntt_length(n, n))
+    {
+        return words_mul_ntt(r, a, n, b, n);
+    }
+    if (n >= TOOM3_THRESHOLD)
+    {
+        return words_toom3(r, a, b, n);
+    }
+
+    scratch = (bi_word*)malloc(karatsuba_scratch_size(n, KARATSUBA_THRESHOLD) * sizeof(bi_word));
+    if (!scratch) return false;
+    words_karatsuba(r, a, b, n, scratch);
+    free(scratch);
+    return true;
+}
+
+/*
+ * General product dispatcher, r has an + bn words.
+ * Unbalanced operands are cut into slices of the shorter length.
+ */
+static bool words_mul(bi_word* r, const bi_word* a, size_t an, const bi_word* b, size_t bn)
+{
+    const bi_word* tmp_ptr;
+    size_t tmp_len;
+    bi_word* slice;
+    size_t i;
+    bool ok = true;
+
+    if (an < bn)
+    {
+        tmp_ptr = a; a = b; b = tmp_ptr;
+        tmp_len = an; an = bn; bn = tmp_len;
+    }
+
+    if (bn < KARATSUBA_THRESHOLD)
+    {
+        words_mul_basecase(r, a, an, b, bn);
+        return true;
+    }
+    if (an == bn)
+    {
+        return words_mul_n(r, a, b, an);
+    }
+    if (bn >= NTT_THRESHOLD && ntt_length(an, bn))
+    {
+        return words_mul_ntt(r, a, an, b, bn);
+    }
+
+    slice = (bi_word*)malloc(2 * bn * sizeof(bi_word));
+    if (!slice) return false;
+
+    memset(r, 0, (an + bn) * sizeof(bi_word));
+    for (i = 0; ok && i + bn <= an; i += bn)
+    {
+        ok = words_mul_n(slice, a + i, b, bn);
+        if (ok) words_add(r + i, r + i, an + bn - i, slice, 2 * bn);
+    }
+    if (ok && i < an)
+    {
+        ok = words_mul(slice, b, bn, a + i, an - i);
+        if (ok) words_add(r + i, r + i, an + bn - i, slice, bn + an - i);
+    }
+
+    free(slice);
+    return ok;
+}
+
+/* Square of an n-word operand, r has 2n words */
+static bool words_sqr(bi_word* r, const bi_word* a, size_t n)
+{
+    bi_word* scratch;
+
+    if (n < KARATSUBA_SQR_THRESHOLD)
+    {
+        words_sqr_basecase(r, a, n);
+        return true;
+    }
+    if (n >= NTT_SQR_THRESHOLD && ntt_length(n, n))
+    {
+        return words_mul_ntt(r, a, n, NULL, n);
+    }
+    if (n >= TOOM3_SQR_THRESHOLD)
+    {
+        return words_toom3(r, a, NULL, n);
+    }
+
+    scratch = (bi_word*)malloc(karatsuba_scratch_size(n, KARATSUBA_SQR_THRESHOLD) * sizeof(bi_word));
+    if (!scratch) return false;
+    words_karatsuba_sqr(r, a, n, scratch);
+    free(scratch);
+    return true;
+}
+
+/* DIVISION KERNELS */
+
+/*
+ * Knuth's Algorithm D (TAOCP 4.3.1) for an >= bn >= 2 with b[bn - 1] != 0.
+ * q receives an - bn + 1 words and r receives bn words, either may be NULL.
+ */
+static bool words_divmod_knuth(bi_word* q, bi_word* r, const bi_word* a, size_t an,
+                               const bi_word* b, size_t bn)
+{
+    bi_word* un;
+    bi_word* vn;
+    unsigned int s;
+    size_t j;
+    bi_dword num, qhat, rhat;
+    bi_word borrow, top;
+
+    un = (bi_word*)malloc((an + 1 + bn) * sizeof(bi_word));
+    if (!un) return false;
+    vn = un + an + 1;
+
+    /* D1: normalize so that the top bit of the divisor is set */
+    s = (unsigned int)word_leading_zeros(b[bn - 1]);
+    words_shl(vn, b, bn, s);
+    un[an] = words_shl(un, a, an, s);
+
+    for (j = an - bn + 1; j > 0; j--)
+    {
+        /* D3: estimate the quotient word from the top two words */
+        num = ((bi_dword)un[j - 1 + bn] << BITS_IN_WORD) | un[j - 2 + bn];
+        qhat = num / vn[bn - 1];
+        rhat = num % vn[bn - 1];
+
+        while (qhat >> BITS_IN_WORD ||
+            qhat * vn[bn - 2] > ((rhat << BITS_IN_WORD) | un[j - 3 + bn]))
+        {
+            qhat--;
+            rhat += vn[bn - 1];
+            if (rhat >> BITS_IN_WORD) break;
+        }
+
+        /* D4: multiply and subtract */
+        borrow = words_submul_1(un + j - 1, vn, bn, (bi_word)qhat);
+        top = un[j - 1 + bn];
+        un[j - 1 + bn] = top - borrow;
+        if (top < borrow)
+        {
+            /* D6: the estimate was one too large, add back */
+            qhat--;
+            un[j - 1 + bn] += words_add(un + j - 1, un + j - 1, bn, vn, bn);
+        }
+        if (q) q[j - 1] = (bi_word)qhat;
+    }
+
+    /* D8: unnormalize the remainder */
+    if (r) words_shr(r, un, bn, s);
+    free(un);
+    return true;
+}
+
+static BigInt* bi_from_word(bi_word value)
+{
+    return bi_from_words(&value, 1);
+}
+
+/* Initializes a caller owned BigInt to a one word value, never allocates */
+static void bi_init_word(BigInt* num, bi_word value)
+{
+    bi_init(num);
+    num->digits[0] = value;
+    num->sign = value != 0;
+}
+
+/* Magnitude of the words [from, from + count) of a, count is clipped to the length */
+static BigInt* bi_word_slice(const BigInt* a, size_t from, size_t count)
+{
+    if (!a) return NULL;
+    if (from >= a->length) return bi_create();
+    if (count > a->length - from) count = a->length - from;
+    return bi_from_words(a->digits + from, count);
+}
+
+/*
+ * Schoolbook quotient and remainder of magnitudes, single word or Knuth D.
+ * Either output may be NULL, that result is then not built.
+ */
+static bool bi_div_mod_basecase(const BigInt* a, const BigInt* b, BigInt** quotient, BigInt** remainder)
+{
+    BigInt* q = NULL;
+    BigInt* r = NULL;
+    bi_word rem;
+    bool ok = true;
+
+    if (quotient) *quotient = NULL;
+    if (remainder) *remainder = NULL;
+
+    if (bi_compare_abs(a, b) < 0)
+    {
+        if (quotient) ok = (q = bi_create()) != NULL;
+        if (ok && remainder) ok = (r = bi_word_slice(a, 0, a->length)) != NULL;
+    }
+    else if (b->length == 1)
+    {
+        if (quotient)
+        {
+            q = bi_create();
+            ok = q && bi_resize(q, a->length);
+            if (ok)
+            {
+                rem = words_divmod_1(q->digits, a->digits, a->length, b->digits[0]);
+                q->length = a->length;
+                q->sign = 1;
+            }
+        }
+        else
+        {
+            rem = words_mod_1(a->digits, a->length, b->digits[0]);
+        }
+        if (ok && remainder) ok = (r = bi_from_word(rem)) != NULL;
+    }
+    else
+    {
+        if (quotient)
+        {
+            q = bi_create();
+            ok = q && bi_resize(q, a->length - b->length + 1);
+        }
+        if (ok && remainder)
+        {
+            r = bi_create();
+            ok = r && bi_resize(r, b->length);
+        }
+        ok = ok && words_divmod_knuth(q ? q->digits : NULL, r ? r->digits : NULL,
+                                      a->digits, a->length, b->digits, b->length);
+        if (ok && q)
+        {
+            q->length = a->length - b->length + 1;
+            q->sign = 1;
+        }
+        if (ok && r)
+        {
+            r->length = b->length;
+            r->sign = 1;
+        }
+    }
+
+    if (!ok)
+    {
+        bi_destroy(q);
+        bi_destroy(r);
+        return false;
+    }
+
+    if (q)
+    {
+        bi_normalize(q);
+        *quotient = q;
+    }
+    if (r)
+    {
+        bi_normalize(r);
+        *remainder = r;
+    }
+    return true;
+}
+
+static bool bi_bz_div_2n1n(const BigInt* a, const BigInt* b, size_t n, BigInt** quotient, BigInt** remainder);
+
+/*
+ * Burnikel-Ziegler step dividing a 3n-word value by a 2n-word divisor b with
+ * the top bit set, under the precondition a < b * B^n.
+ */
+static bool bi_bz_div_3n2n(const BigInt* a, const BigInt* b, size_t n, BigInt** quotient, BigInt** remainder)
+{
+    size_t n_bits = n * BITS_IN_WORD;
+    BigInt *a12, *a3, *a1, *b1, *b2;
+    BigInt *q = NULL, *r = NULL, *d = NULL;
+    BigInt one;
+    bool ok;
+
+    a12 = bi_word_slice(a, n, a->length);
+    a3 = bi_word_slice(a, 0, n);
+    a1 = bi_word_slice(a, 2 * n, a->length);
+    b1 = bi_word_slice(b, n, b->length);
+    b2 = bi_word_slice(b, 0, n);
+    bi_init_word(&one, 1);
+    ok = a12 && a3 && a1 && b1 && b2;
+
+    if (ok && bi_compare_abs(a1, b1) < 0)
+    {
+        /* q = [a1, a2] / b1, r = [a1, a2] % b1 */
+        ok = bi_bz_div_2n1n(a12, b1, n, &q, &r);
+        if (ok) d = bi_mul(q, b2);
+    }
+    else if (ok)
+    {
+        /* q = B^n - 1, r = [a1, a2] - q * b1 = [a1, a2] - b1 * B^n + b1 */
+        q = bi_shift_left(&one, n_bits);
+        q = bi_replace(q, bi_sub(q, &one));
+        d = bi_shift_left(b1, n_bits);
+        r = bi_add(a12, b1);
+        r = bi_replace(r, bi_sub(r, d));
+
+        /* d = q * b2 = b2 * B^n - b2 */
+        d = bi_replace(d, bi_shift_left(b2, n_bits));
+        d = bi_replace(d, bi_sub(d, b2));
+    }
+
+    /* r = [r, a3] - q * b2, corrected by at most two additions of b */
+    r = bi_replace(r, bi_shift_left(r, n_bits));
+    r = bi_replace(r, bi_add(r, a3));
+    r = bi_replace(r, bi_sub(r, d));
+    while (ok && r && q && r->sign < 0)
+    {
+        r = bi_replace(r, bi_add(r, b));
+        q = bi_replace(q, bi_sub(q, &one));
+    }
+
+    bi_destroy(a12); bi_destroy(a3); bi_destroy(a1);
+    bi_destroy(b1); bi_destroy(b2); bi_destroy(d);
+
+    if (!ok || !q || !r)
+    {
+        bi_destroy(q);
+        bi_destroy(r);
+        return false;
+    }
+    *quotient = q;
+    *remainder = r;
+    return true;
+}
+
+/*
+ * Burnikel-Ziegler step dividing a 2n-word value by an n-word divisor b with
+ * the top bit set, under the precondition a < b * B^n.
+ */
+static bool bi_bz_div_2n1n(const BigInt* a, const BigInt* b, size_t n, BigInt** quotient, BigInt** remainder)
+{
+    size_t half = n / 2;
+    BigInt *upper, *lower, *q1, *r1, *q2, *r2, *t;
+    bool ok;
+
+    if ((n & 1) || n < BZ_THRESHOLD)
+    {
+        return bi_div_mod_basecase(a, b, quotient, remainder);
+    }
+
+    q1 = r1 = q2 = r2 = NULL;
+    upper = bi_word_slice(a, half, a->length);
+    lower = bi_word_slice(a, 0, half);
+    ok = upper && lower && bi_bz_div_3n2n(upper, b, half, &q1, &r1);
+
+    t = ok ? bi_shift_left(r1, half * BITS_IN_WORD) : NULL;
+    t = bi_replace(t, bi_add(t, lower));
+    ok = t && bi_bz_div_3n2n(t, b, half, &q2, &r2);
+
+    if (ok)
+    {
+        q1 = bi_replace(q1, bi_shift_left(q1, half * BITS_IN_WORD));
+        q1 = bi_replace(q1, bi_add(q1, q2));
+        ok = q1 != NULL;
+    }
+
+    bi_destroy(upper);
+    bi_destroy(lower);
+    bi_destroy(t);
+    bi_destroy(r1);
+    bi_destroy(q2);
+
+    if (!ok)
+    {
+        bi_destroy(q1);
+        bi_destroy(r2);
+        return false;
+    }
+    *quotient = q1;
+    *remainder = r2;
+    return true;
+}
+
+/*
+ * Recursive division of Burnikel and Ziegler, "Fast Recursive Division" (1998).
+ * The divisor is padded to n = j * 2^k words with its top bit set, the
+ * dividend is processed in blocks of n words from the top. Either output may
+ * be NULL: the quotient blocks are then dropped, or the final remainder is
+ * not shifted back.
+ */
+static bool bi_div_mod_bz(const BigInt* a, const BigInt* b, BigInt** quotient, BigInt** remainder)
+{
+    size_t m = 1;
+    size_t n, n_bits, sigma, t, i;
+    BigInt *as, *bs, *z, *q, *qi = NULL, *ri = NULL, *block;
+    bool ok;
+
+    while (m * BZ_THRESHOLD <= b->length)
+    {
+        m <<= 1;
+    }
+    n = ((b->length + m - 1) / m) * m;
+    n_bits = n * BITS_IN_WORD;
+    sigma = n_bits - bi_bit_length(b);
+
+    as = bi_shift_left(a, sigma);
+    bs = bi_shift_left(b, sigma);
+    if (!as || !bs)
+    {
+        bi_destroy(as);
+        bi_destroy(bs);
+        return false;
+    }
+    as->sign = 1;
+    bs->sign = 1;
+
+    /* Number of blocks, keeping one spare bit above the top block */
+    t = (bi_bit_length(as) + n_bits) / n_bits;
+    if (t < 2) t = 2;
+
+    q = NULL;
+    z = bi_word_slice(as, (t - 2) * n, 2 * n);
+    ok = z != NULL;
+    if (ok && quotient)
+    {
+        q = bi_create();
+        ok = q && bi_resize(q, (t - 1) * n);
+        if (ok)
+        {
+            memset(q->digits, 0, (t - 1) * n * sizeof(bi_word));
+            q->length = (t - 1) * n;
+        }
+    }
+
+    for (i = t - 1; ok && i > 0; i--)
+    {
+        ok = bi_bz_div_2n1n(z, bs, n, &qi, &ri);
+        if (!ok) break;
+
+        if (q && qi->sign != 0)
+        {
+            memcpy(q->digits + (i - 1) * n, qi->digits, qi->length * sizeof(bi_word));
+        }
+        bi_destroy(qi);
+        qi = NULL;
+
+        if (i > 1)
+        {
+            /* z = [ri, a[i - 2]] */
+            block = bi_word_slice(as, (i - 2) * n, n);
+            z = bi_replace(z, bi_shift_left(ri, n_bits));
+            z = bi_replace(z, bi_add(z, block));
+            bi_destroy(block);
+            bi_destroy(ri);
+            ri = NULL;
+            ok = z != NULL;
+        }
+    }
+
+    bi_destroy(as);
+    bi_destroy(bs);
+    bi_destroy(z);
+
+    if (!ok)
+    {
+        bi_destroy(q);
+        bi_destroy(ri);
+        return false;
+    }
+
+    if (q)
+    {
+        q->sign = 1;
+        bi_normalize(q);
+        *quotient = q;
+    }
+    if (!remainder)
+    {
+        bi_destroy(ri);
+        return true;
+    }
+    *remainder = bi_replace(ri, bi_shift_right(ri, sigma));
+    return *remainder != NULL;
+}
+
+/* DECIMAL CONVERSION HELPERS */
+
+/*
+ * Decimal conversion works in chunks of DEC_CHUNK_DIGITS digits (one word
+ * division or multiplication per chunk). Huge numbers are split recursively
+ * by powers 10^(DEC_CHUNK_DIGITS * 2^k), which are computed on first use and
+ * kept for later calls.
+ */
+
+static BigInt* dec_powers[DEC_POWERS_MAX];
+static size_t dec_powers_count = 0;
+static pthread_mutex_t dec_powers_lock = PTHREAD_MUTEX_INITIALIZER;  /* Guards growing the table */
+
+/* Returns 10^(DEC_CHUNK_DIGITS * 2^k), or NULL on allocation failure */
+static const BigInt* dec_power(size_t k)
+{
+    BigInt* next;
+    size_t count;
+
+    if (k >= DEC_POWERS_MAX) return NULL;
+
+    pthread_mutex_lock(&dec_powers_lock);
+    while ((count = dec_powers_count) <= k)
+    {
+        /* The squaring may run parallel tasks, so the table is not locked meanwhile */
+        pthread_mutex_unlock(&dec_powers_lock);
+        if (count == 0)
+        {
+            next = bi_from_word(DEC_CHUNK);
+        }
+        else
+        {
+            next = bi_sqr(dec_powers[count - 1]);
+        }
+        if (!next) return NULL;
+
+        pthread_mutex_lock(&dec_powers_lock);
+        if (dec_powers_count == count)
+        {
+            dec_powers[dec_powers_count++] = next;
+        }
+        else
+        {
+            /* Another thread was faster */
+            bi_destroy(next);
+        }
+    }
+    next = dec_powers[k];
+    pthread_mutex_unlock(&dec_powers_lock);
+    return next;
+}
+
+/* Writes exactly digits decimal digits of value, left padded with zeros */
+static void dec_write_chunk(char* out, bi_word value, int digits)
+{
+    while (digits > 0)
+    {
+        out[--digits] = (char)('0' + value % BASE_DEC);
+        value /= BASE_DEC;
+    }
+}
+
+static int dec_chunk_digits(bi_word value)
+{
+    int digits = 1;
+
+    while (value >= BASE_DEC)
+    {
+        value /= BASE_DEC;
+        digits++;
+    }
+    return digits;
+}
+
+/*
+ * Writes |x| in decimal by repeated division by DEC_CHUNK. With a non-zero width
+ * the output is left padded with zeros to exactly width characters.
+ * Returns the number of characters written, or 0 on allocation failure.
+ */
+static size_t dec_write_basecase(const BigInt* x, char* out, size_t width)
+{
+    bi_word local[2 * DEC_DC_THRESHOLD + DEC_DC_THRESHOLD / 8 + 2];
+    bi_word* work = local;
+    bi_word* chunks;
+    size_t len, count = 0, digits, pos = 0, i;
+
+    /* A word holds less than 9/8 chunks (9.64 of 9 or 19.27 of 19 digits) */
+    len = words_length(x->digits, x->length);
+    if (len > DEC_DC_THRESHOLD)
+    {
+        work = (bi_word*)malloc((2 * len + len / 8 + 2) * sizeof(bi_word));
+        if (!work) return 0;
+    }
+    chunks = work + len;
+
+    memcpy(work, x->digits, len * sizeof(bi_word));
+    while (len > 0)
+    {
+        chunks[count++] = words_divmod_1(work, work, len, DEC_CHUNK);
+        len = words_length(work, len);
+    }
+
+    digits = 0;
+    if (count > 0)
+    {
+        digits = dec_chunk_digits(chunks[count - 1]) + (count - 1) * DEC_CHUNK_DIGITS;
+    }
+    else if (width == 0)
+    {
+        chunks[count++] = 0;
+        digits = 1;
+    }
+
+    if (width > digits)
+    {
+        memset(out, '0', width - digits);
+        pos = width - digits;
+    }
+
+    if (count > 0)
+    {
+        dec_write_chunk(out + pos, chunks[count - 1], dec_chunk_digits(chunks[count - 1]));
+        pos += dec_chunk_digits(chunks[count - 1]);
+        for (i = count - 1; i > 0; i--)
+        {
+            dec_write_chunk(out + pos, chunks[i - 1], DEC_CHUNK_DIGITS);
+            pos += DEC_CHUNK_DIGITS;
+        }
+    }
+
+    if (work != local) free(work);
+    return pos;
+}
+
+/*
+ * Divide and conquer conversion of |x| < 10^(c * 2^(k + 1)), c = DEC_CHUNK_DIGITS:
+ * the upper half x / 10^(c * 2^k) and the zero padded lower half are converted
+ * separately, in parallel for huge numbers. With pad set exactly c * 2^(k + 1)
+ * characters are written.
+ */
+static size_t dec_write_rec(const BigInt* x, size_t k, char* out, bool pad, bool* ok);
+
+/* Zero padded conversion of a lower half, run as a task */
+typedef struct
+{
+    const BigInt* x;
+    size_t k;
+    char* out;
+    size_t written;
+    bool ok;
+} DecJob;
+
+static void dec_job_run(void* arg)
+{
+    DecJob* job = (DecJob*)arg;
+
+    job->written = dec_write_rec(job->x, job->k, job->out, true, &job->ok);
+}
+
+static size_t dec_write_rec(const BigInt* x, size_t k, char* out, bool pad, bool* ok)
+{
+    size_t width = pad ? (size_t)DEC_CHUNK_DIGITS << (k + 1) : 0;
+    const BigInt* power;
+    BigInt *q, *r;
+    size_t written, half;
+    DecJob job;
+    ThreadTask task;
+
+    if (!*ok) return 0;
+
+    if (k == 0 || x->length < DEC_DC_THRESHOLD)
+    {
+        written = dec_write_basecase(x, out, width);
+        if (written == 0) *ok = false;
+        return written;
+    }
+
+    power = dec_power(k);
+    if (!power)
+    {
+        *ok = false;
+        return 0;
+    }
+    if (!pad && bi_compare_abs(x, power) < 0)
+    {
+        return dec_write_rec(x, k - 1, out, false, ok);
+    }
+
+    bi_div_mod_abs(x, power, &q, &r);
+    if (!q || !r)
+    {
+        bi_destroy(q);
+        bi_destroy(r);
+        *ok = false;
+        return 0;
+    }
+
+    half = (size_t)DEC_CHUNK_DIGITS << k;
+    job.x = r;
+    job.k = k - 1;
+    job.ok = true;
+    job.out = NULL;
+    if (parallel_worth(x->length))
+    {
+        /* The lower half has a fixed width; with an unknown upper width it goes to a side buffer */
+        job.out = pad ? out + half : (char*)malloc(half);
+    }
+
+    if (job.out)
+    {
+        thread_pool_spawn(&task, dec_job_run, &job);
+        written = dec_write_rec(q, k - 1, out, pad, ok);
+        thread_pool_join(&task);
+        if (!pad)
+        {
+            memcpy(out + written, job.out, half);
+            free(job.out);
+        }
+        written += job.written;
+        if (!job.ok) *ok = false;
+    }
+    else
+    {
+        written = dec_write_rec(q, k - 1, out, pad, ok);
+        written += dec_write_rec(r, k - 1, out + written, true, ok);
+    }
+    bi_destroy(q);
+    bi_destroy(r);
+    return written;
+}
+
+/* Parses exactly len decimal digits, one word multiply-add per chunk */
+static BigInt* dec_read_basecase(const char* s, size_t len)
+{
+    BigInt* res;
+    size_t n = 0, i = 0, j, chunk_len;
+    bi_dword carry, current;
+    bi_word chunk;
+
+    res = bi_create();
+    if (!res) return NULL;
+    if (!bi_resize(res, len / DEC_CHUNK_DIGITS + 2))
+    {
+        bi_destroy(res);
+        return NULL;
+    }
+
+    chunk_len = len % DEC_CHUNK_DIGITS;
+    if (chunk_len == 0) chunk_len = DEC_CHUNK_DIGITS;
+
+    while (i < len)
+    {
+        chunk = 0;
+        for (j = 0; j < chunk_len; j++)
+        {
+            chunk = chunk * BASE_DEC + (bi_word)(s[i + j] - '0');
+        }
+        i += chunk_len;
+        chunk_len = DEC_CHUNK_DIGITS;
+
+        carry = chunk;
+        for (j = 0; j < n; j++)
+        {
+            current = (bi_dword)res->digits[j] * DEC_CHUNK + carry;
+            res->digits[j] = (bi_word)current;
+            carry = current >> BITS_IN_WORD;
+        }
+        if (carry) res->digits[n++] = (bi_word)carry;
+    }
+
+    if (n > 0)
+    {
+        res->length = n;
+        res->sign = 1;
+    }
+    return res;
+}
+
+/*
+ * Divide and conquer parsing of len decimal digits: the last c * 2^k digits
+ * (c = DEC_CHUNK_DIGITS) and the rest are parsed separately and combined by
+ * one multiplication with the cached power 10^(c * 2^k).
+ */
+static BigInt* dec_read_rec(const char* s, size_t len)
+{
+    size_t k = 0;
+    size_t low_len;
+    BigInt *high, *low, *res;
+
+    if (len < (size_t)DEC_DC_THRESHOLD * DEC_CHUNK_DIGITS)
+    {
+        return dec_read_basecase(s, len);
+    }
+
+    while (((size_t)DEC_CHUNK_DIGITS << (k + 1)) < len)
+    {
+        k++;
+    }
+    low_len = (size_t)DEC_CHUNK_DIGITS << k;
+
+    high = dec_read_rec(s, len - low_len);
+    low = dec_read_rec(s + len - low_len, low_len);
+    res = bi_mul(high, dec_power(k));
+    res = bi_replace(res, bi_add(res, low));
+
+    bi_destroy(high);
+    bi_destroy(low);
+    return res;
+}
+
+/* STREAM OUTPUT HELPERS */
+
+/* Characters collected into blocks written to a stream */
+typedef struct
+{
+    FILE* f;
+    size_t used;
+    bool ok;
+    char block[WRITE_BLOCK_SIZE];
+} BlockWriter;
+
+static void writer_flush(BlockWriter* w)
+{
+    if (w->ok && w->used > 0 && fwrite(w->block, 1, w->used, w->f) != w->used) w->ok = false;
+    w->used = 0;
+}
+
+static void writer_put(BlockWriter* w, char c)
+{
+    if (w->used == WRITE_BLOCK_SIZE) writer_flush(w);
+    w->block[w->used++] = c;
+}
+
+/* Writes a long run of characters past the block */
+static void writer_write(BlockWriter* w, const char* chars, size_t count)
+{
+    writer_flush(w);
+    if (w->ok && count > 0 && fwrite(chars, 1, count, w->f) != count) w->ok = false;
+}
+
+/*
+ * Two's complement of |n| over its words, as printed for negative numbers.
+ * Positive numbers are returned as they are, NULL only on allocation failure.
+ */
+static BigInt* complement_for_output(const BigInt* n)
+{
+    BigInt* working = bi_copy(n);
+    size_t i;
+
+    if (!working || n->sign != -1) return working;
+
+    for (i = 0; i < working->length; i++)
+    {
+        working->digits[i] = ~working->digits[i];
+    }
+    bi_add_digit_into(working, 1);
+    working->sign = 1;
+    return working;
+}
+
+static int hex_digit_at(const BigInt* x, size_t i)
+{
+    if (i / HEX_WIDTH >= x->length) return 0;
+    return (int)((x->digits[i / HEX_WIDTH] >> (4 * (i % HEX_WIDTH))) & 0xF);
+}
+
+/* Checks the 32-bit group of eight hex digits ending with the digit top */
+static bool hex_group_is_zero(const BigInt* x, size_t top)
+{
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+    {
+        if (hex_digit_at(x, top - i) != 0) return false;
+    }
+    return true;
+}
+
+/* Two hex characters for every byte value, "00" to "ff" */
+#define HEX_PAIRS_ROW(h) h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+                         h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+static const char hex_pairs[] =
+    HEX_PAIRS_ROW("0") HEX_PAIRS_ROW("1") HEX_PAIRS_ROW("2") HEX_PAIRS_ROW("3")
+    HEX_PAIRS_ROW("4") HEX_PAIRS_ROW("5") HEX_PAIRS_ROW("6") HEX_PAIRS_ROW("7")
+    HEX_PAIRS_ROW("8") HEX_PAIRS_ROW("9") HEX_PAIRS_ROW("a") HEX_PAIRS_ROW("b")
+    HEX_PAIRS_ROW("c") HEX_PAIRS_ROW("d") HEX_PAIRS_ROW("e") HEX_PAIRS_ROW("f");
+
+/* Eight binary characters for every byte value, most significant bit first */
+#define BIN_BITS_1(p) p "0" p "1"
+#define BIN_BITS_2(p) BIN_BITS_1(p "0") BIN_BITS_1(p "1")
+#define BIN_BITS_3(p) BIN_BITS_2(p "0") BIN_BITS_2(p "1")
+#define BIN_BITS_4(p) BIN_BITS_3(p "0") BIN_BITS_3(p "1")
+#define BIN_BITS_5(p) BIN_BITS_4(p "0") BIN_BITS_4(p "1")
+#define BIN_BITS_6(p) BIN_BITS_5(p "0") BIN_BITS_5(p "1")
+#define BIN_BITS_7(p) BIN_BITS_6(p "0") BIN_BITS_6(p "1")
+static const char bin_bytes[] = BIN_BITS_7("0") BIN_BITS_7("1");
+
+static bi_word word_at(const BigInt* x, size_t i)
+{
+    return i < x->length ? x->digits[i] : 0;
+}
+
+/*
+ * Writes count hex digits of x, from the digit top downwards. Whole words
+ * are expanded a byte, two characters, per lookup; only a start inside a
+ * word and the end of the range go digit by digit.
+ */
+static void hex_emit(const BigInt* x, size_t top, size_t count, char* out)
+{
+    size_t end = top + 1;   /* Digits below end remain */
+    size_t bottom = end - count;
+    bi_word word;
+    int shift;
+
+    while (end > bottom)
+    {
+        if (end % HEX_WIDTH == 0 && end - bottom >= HEX_WIDTH)
+        {
+            word = word_at(x, end / HEX_WIDTH - 1);
+            for (shift = BITS_IN_WORD - 8; shift >= 0; shift -= 8)
+            {
+                memcpy(out, hex_pairs + 2 * ((word >> shift) & 0xFF), 2);
+                out += 2;
+            }
+            end -= HEX_WIDTH;
+        }
+        else
+        {
+            *out++ = HEX_DIGITS[hex_digit_at(x, --end)];
+        }
+    }
+}
+
+/* Writes count bits of x like hex_emit(), eight characters per lookup */
+static void bin_emit(const BigInt* x, size_t top, size_t count, char* out)
+{
+    size_t end = top + 1;
+    size_t bottom = end - count;
+    bi_word word;
+    int shift;
+
+    while (end > bottom)
+    {
+        if (end % BITS_IN_WORD == 0 && end - bottom >= BITS_IN_WORD)
+        {
+            word = word_at(x, end / BITS_IN_WORD - 1);
+            for (shift = BITS_IN_WORD - 8; shift >= 0; shift -= 8)
+            {
+                memcpy(out, bin_bytes + 8 * ((word >> shift) & 0xFF), 8);
+                out += 8;
+            }
+            end -= BITS_IN_WORD;
+        }
+        else
+        {
+            *out++ = bi_get_bit(x, --end) ? '1' : '0';
+        }
+    }
+}
+
+/* Streams digits top..0 through the block of the writer */
+static void writer_emit(BlockWriter* w, const BigInt* x, size_t top,
+                        void (*emit)(const BigInt*, size_t, size_t, char*))
+{
+    size_t remaining = top + 1;
+    size_t count;
+
+    while (remaining > 0)
+    {
+        if (w->used == WRITE_BLOCK_SIZE) writer_flush(w);
+        count = WRITE_BLOCK_SIZE - w->used;
+        if (count > remaining) count = remaining;
+        emit(x, remaining - 1, count, w->block + w->used);
+        w->used += count;
+        remaining -= count;
+    }
+}
+
+/*
+ * Index of the most significant hex digit printed for n, with working from
+ * complement_for_output(). Digits are counted in whole 32-bit groups as with
+ * 32-bit words: a positive number gets a leading zero when its top digit
+ * reads as negative and the group has room, a negative number drops its
+ * zero groups and keeps one f in front of a digit of 8 or more.
+ */
+static size_t hex_top_digit(const BigInt* n, const BigInt* working, bool* leading_zero)
+{
+    size_t bits = bi_bit_length(n);
+    size_t group = (bits + 31) / 32 * 8;
+    size_t top;
+
+    *leading_zero = false;
+    if (n->sign == 1)
+    {
+        top = (bits + 3) / 4 - 1;
+        *leading_zero = top + 1 < group && hex_digit_at(working, top) >= 8;
+        return top;
+    }
+
+    /* 32-bit words of the complement that became zero were normalized away */
+    top = group - 1;
+    while (top >= 8 && hex_group_is_zero(working, top))
+    {
+        top -= 8;
+    }
+
+    while (top > 0 && hex_digit_at(working, top) == 0xF && hex_digit_at(working, top - 1) >= 8)
+    {
+        top--;
+    }
+    return top;
+}
+
+/*
+ * Index of the most significant bit printed for n, with working from
+ * complement_for_output(). A positive number is preceded by one zero, the
+ * run of leading ones of a negative number shrinks to one.
+ */
+static size_t bin_top_bit(const BigInt* n, BigInt* working)
+{
+    size_t group_bits;
+    size_t top;
+
+    if (n->sign == 1) return bi_bit_length(n) - 1;
+
+    /* The complement spans whole 32-bit groups as with 32-bit words */
+    group_bits = (bi_bit_length(n) + 31) / 32 * 32;
+    if (group_bits < working->length * BITS_IN_WORD)
+    {
+        working->digits[working->length - 1] &= ((bi_word)1 << (group_bits % BITS_IN_WORD)) - 1;
+        bi_normalize(working);
+    }
+
+    top = bi_bit_length(working) - 1;
+    while (top > 0 && bi_get_bit(working, top - 1))
+    {
+        top--;
+    }
+    return top;
+}
+
+/*
+ * Streams |x| < 10^(c * 2^(k + 1)), c = DEC_CHUNK_DIGITS, like dec_write_rec()
+ * but keeps only pieces of at most DEC_STREAM_DIGITS characters in memory.
+ */
+static void dec_stream_rec(const BigInt* x, size_t k, bool pad, BlockWriter* w)
+{
+    size_t bound = (size_t)DEC_CHUNK_DIGITS << (k + 1);
+    const BigInt* power;
+    BigInt *q, *r;
+    char* piece;
+    size_t written;
+    bool ok = true;
+
+    if (!w->ok) return;
+
+    if (k == 0 || bound <= DEC_STREAM_DIGITS)
+    {
+        piece = (char*)malloc(bound);
+        if (!piece)
+        {
+            w->ok = false;
+            return;
+        }
+        written = dec_write_rec(x, k, piece, pad, &ok);
+        if (ok) writer_write(w, piece, written);
+        else w->ok = false;
+        free(piece);
+        return;
+    }
+
+    power = dec_power(k);
+    if (!power)
+    {
+        w->ok = false;
+        return;
+    }
+    if (!pad && bi_compare_abs(x, power) < 0)
+    {
+        dec_stream_rec(x, k - 1, false, w);
+        return;
+    }
+
+    bi_div_mod_abs(x, power, &q, &r);
+    if (!q || !r)
+    {
+        bi_destroy(q);
+        bi_destroy(r);
+        w->ok = false;
+        return;
+    }
+
+    dec_stream_rec(q, k - 1, pad, w);
+    dec_stream_rec(r, k - 1, true, w);
+    bi_destroy(q);
+    bi_destroy(r);
+}
+
+/* RAW FORMAT HELPERS */
+
+/* Number of 64-bit limbs holding |n| */
+static size_t raw_limb_count(const BigInt* n)
+{
+    if (n->sign == 0) return 0;
+    return (n->length * sizeof(bi_word) + BI_RAW_LIMB_SIZE - 1) / BI_RAW_LIMB_SIZE;
+}
+
+static void raw_put_u64(unsigned char* p, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint64_t raw_get_u64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static bool raw_host_is_little_endian(void)
+{
+    const uint16_t probe = 1;
+
+    return *(const unsigned char*)&probe == 1;
+}
+
+static void raw_write_header(const BigInt* n, unsigned char* out)
+{
+    memcpy(out, BI_RAW_MAGIC, 4);
+    out[4] = BI_RAW_LIMB_SIZE;
+    out[5] = (unsigned char)(n->sign < 0 ? 0xFF : n->sign);
+    out[6] = 0;
+    out[7] = 0;
+    raw_put_u64(out + 8, (uint64_t)raw_limb_count(n));
+}
+
+/* Dumps |n| as little-endian limbs, a plain copy of the words on little-endian hosts */
+static void raw_write_limbs(const BigInt* n, unsigned char* out)
+{
+    size_t count = raw_limb_count(n);
+    size_t i, j;
+
+    if (count == 0) return;
+
+    if (raw_host_is_little_endian())
+    {
+        memcpy(out, n->digits, n->length * sizeof(bi_word));
+        memset(out + n->length * sizeof(bi_word), 0, count * BI_RAW_LIMB_SIZE - n->length * sizeof(bi_word));
+        return;
+    }
+
+    memset(out, 0, count * BI_RAW_LIMB_SIZE);
+    for (i = 0; i < n->length; i++)
+    {
+        for (j = 0; j < sizeof(bi_word); j++)
+        {
+            out[i * sizeof(bi_word) + j] = (unsigned char)(n->digits[i] >> (8 * j));
+        }
+    }
+}
+
+/* Checks the header and reads the sign and the number of limbs */
+static bool raw_read_header(const unsigned char* in, int* sign, size_t* count)
+{
+    uint64_t limbs;
+
+    if (memcmp(in, BI_RAW_MAGIC, 4) != 0 || in[4] != BI_RAW_LIMB_SIZE) return false;
+
+    /* Reserved for later versions of the format */
+    if (in[6] != 0 || in[7] != 0) return false;
+
+    if (in[5] == 0xFF) *sign = -1;
+    else if (in[5] <= 1) *sign = in[5];
+    else return false;
+
+    limbs = raw_get_u64(in + 8);
+    if (limbs > (uint64_t)((size_t)-1 / BI_RAW_LIMB_SIZE)) return false;
+    *count = (size_t)limbs;
+    return (*sign == 0) == (*count == 0);
+}
+
+static BigInt* raw_read_limbs(const unsigned char* in, size_t count, int sign)
+{
+    size_t bytes = count * BI_RAW_LIMB_SIZE;
+    size_t words = (bytes + sizeof(bi_word) - 1) / sizeof(bi_word);
+    size_t i, j;
+    BigInt* num;
+
+    num = bi_create();
+    if (!num || count == 0) return num;
+
+    if (!bi_resize(num, words))
+    {
+        bi_destroy(num);
+        return NULL;
+    }
+
+    if (raw_host_is_little_endian())
+    {
+        memcpy(num->digits, in, bytes);
+    }
+    else
+    {
+        for (i = 0; i < words; i++)
+        {
+            num->digits[i] = 0;
+            for (j = sizeof(bi_word); j > 0; j--)
+            {
+                num->digits[i] = (num->digits[i] << 8) | in[i * sizeof(bi_word) + j - 1];
+            }
+        }
+    }
+    num->length = words;
+    num->sign = sign;
+    bi_normalize(num);
+    return num;
+}
+
+/* MODULAR EXPONENTIATION HELPERS */
+
+/*
+ * Residues modulo an n-word modulus m are kept in arrays of n words, so no
+ * intermediate is ever longer than 2n + 2 words. Odd moduli use Montgomery
+ * multiplication with R = B^n (B = 2^BITS_IN_WORD) and keep residues as
+ * x * R mod m. Even moduli, and odd ones from MONTGOMERY_MAX_WORDS on where
+ * the quadratic reduction loses to two subquadratic products, use Barrett
+ * reduction with mu = floor(B^2n / m) (HAC 14.42).
+ */
+typedef struct
+{
+    const bi_word* m;
+    size_t n;
+    bool montgomery;
+    bi_word m_inv;      /* -m^-1 mod B, Montgomery only */
+    bi_word* mu;        /* n + 2 words, Barrett only; m = B^(n-1) needs them all */
+    bi_word* product;   /* 2n + 2 words, the product being reduced */
+    bi_word* estimate;  /* 2n + 3 words, Barrett quotient estimate */
+    bi_word* multiple;  /* 2n + 1 words, estimate times m */
+} ModContext;
+
+static int words_compare(const bi_word* a, const bi_word* b, size_t n)
+{
+    while (n > 0)
+    {
+        n--;
+        if (a[n] != b[n]) return a[n] > b[n] ? 1 : -1;
+    }
+    return 0;
+}
+
+/* Copies the value of a number below B^n into n words */
+static void words_load(bi_word* r, size_t n, const BigInt* a)
+{
+    size_t length = a->length < n ? a->length : n;
+
+    memcpy(r, a->digits, length * sizeof(bi_word));
+    memset(r + length, 0, (n - length) * sizeof(bi_word));
+}
+
+static bool mod_init(ModContext* ctx, const BigInt* m)
+{
+    size_t n = m->length;
+    bi_word inverse;
+    BigInt one;
+    BigInt* power;
+    BigInt* q = NULL;
+    int i;
+
+    ctx->m = m->digits;
+    ctx->n = n;
+    ctx->montgomery = (m->digits[0] & 1) && n < MONTGOMERY_MAX_WORDS;
+
+    ctx->product = (bi_word*)malloc((ctx->montgomery ? 2 * n + 2 : 7 * n + 8) * sizeof(bi_word));
+    if (!ctx->product) return false;
+    ctx->estimate = ctx->product + 2 * n + 2;
+    ctx->multiple = ctx->estimate + 2 * n + 3;
+    ctx->mu = ctx->multiple + 2 * n + 1;
+
+    if (ctx->montgomery)
+    {
+        /* Newton's iteration doubles the correct low bits, m * m = 1 mod 8 gives three */
+        inverse = m->digits[0];
+        for (i = 0; i < 6; i++)
+        {
+            inverse *= 2 - m->digits[0] * inverse;
+        }
+        ctx->m_inv = (bi_word)0 - inverse;
+        return true;
+    }
+
+    bi_init_word(&one, 1);
+    power = bi_shift_left(&one, 2 * n * BITS_IN_WORD);
+    if (power) bi_div_mod_abs(power, m, &q, NULL);
+    bi_destroy(power);
+    if (!q)
+    {
+        free(ctx->product);
+        return false;
+    }
+    words_load(ctx->mu, n + 2, q);
+    bi_destroy(q);
+    return true;
+}
+
+static void mod_release(ModContext* ctx)
+{
+    free(ctx->product);
+}
+
+/* Reduces the 2n-word product below m into r */
+static bool mod_reduce(ModContext* ctx, bi_word* r)
+{
+    size_t n = ctx->n;
+    bi_word* t = ctx->product;
+    bi_word* value;
+    bi_word carry;
+    size_t i, j;
+
+    if (ctx->montgomery)
+    {
+        /* t + k * m is divisible by R, where k clears the low words one by one */
+        t[2 * n] = 0;
+        for (i = 0; i < n; i++)
+        {
+            carry = words_addmul_1(t + i, ctx->m, n, t[i] * ctx->m_inv);
+            for (j = i + n; carry && j <= 2 * n; j++)
+            {
+                t[j] += carry;
+                carry = t[j] < carry;
+            }
+        }
+        value = t + n;  /* Below 2m */
+    }
+    else
+    {
+        /* q = floor(floor(t / B^(n-1)) * mu / B^(n+1)) is at most two below t / m */
+        if (!words_mul(ctx->estimate, t + n - 1, n + 1, ctx->mu, n + 2)) return false;
+        if (!words_mul(ctx->multiple, ctx->estimate + n + 1, n + 1, ctx->m, n)) return false;
+        words_sub(t, t, n + 1, ctx->multiple, n + 1);
+        value = t;      /* Below 3m, computed modulo B^(n+1) */
+    }
+
+    while (value[n] != 0 || words_compare(value, ctx->m, n) >= 0)
+    {
+        value[n] -= words_sub(value, value, n, ctx->m, n);
+    }
+    memcpy(r, value, n * sizeof(bi_word));
+    return true;
+}
+
+/* r = a * b mod m in the representation of the context, r may alias a or b */
+static bool mod_mul(ModContext* ctx, bi_word* r, const bi_word* a, const bi_word* b)
+{
+    bool ok = a == b ? words_sqr(ctx->product, a, ctx->n) : words_mul(ctx->product, a, ctx->n, b, ctx->n);
+
+    return ok && mod_reduce(ctx, r);
+}
+
+/* |base|^exponent mod m for a positive exponent and m > 1 */
+static BigInt* powmod_abs(const BigInt* base, const BigInt* exponent, const BigInt* m)
+{
+    ModContext ctx;
+    size_t n = m->length;
+    size_t exp_bits = bi_bit_length(exponent);
+    size_t window = 1;
+    size_t table_size, i, j;
+    long bit, low;
+    unsigned int value;
+    bi_word* residues;
+    bi_word* acc;
+    BigInt* x;
+    BigInt* r = NULL;
+    bool started = false;
+    bool ok;
+
+    if (!mod_init(&ctx, m)) return NULL;
+
+    /* The base enters the representation of the context */
+    bi_div_mod_abs(base, m, NULL, &r);
+    x = r;
+    if (x && ctx.montgomery)
+    {
+        x = bi_replace(x, bi_shift_left(x, n * BITS_IN_WORD));
+        r = NULL;
+        if (x) bi_div_mod_abs(x, m, NULL, &r);
+        bi_destroy(x);
+        x = r;
+    }
+    if (!x)
+    {
+        mod_release(&ctx);
+        return NULL;
+    }
+
+    while (window < POW_WINDOW_MAX && exp_bits > pow_window_bits[window])
+    {
+        window++;
+    }
+    table_size = (size_t)1 << (window - 1);
+
+    /* Odd powers x^1, x^3, ... followed by the accumulator */
+    residues = (bi_word*)malloc((table_size + 1) * n * sizeof(bi_word));
+    if (!residues)
+    {
+        bi_destroy(x);
+        mod_release(&ctx);
+        return NULL;
+    }
+    acc = residues + table_size * n;
+    words_load(residues, n, x);
+    bi_destroy(x);
+
+    ok = true;
+    if (table_size > 1)
+    {
+        ok = mod_mul(&ctx, acc, residues, residues);
+        for (i = 1; ok && i < table_size; i++)
+        {
+            ok = mod_mul(&ctx, residues + i * n, residues + (i - 1) * n, acc);
+        }
+    }
+
+    /* Same sliding window scan as bi_pow() */
+    bit = (long)exp_bits - 1;
+    while (ok && bit >= 0)
+    {
+        if (!bi_get_bit(exponent, (size_t)bit))
+        {
+            ok = mod_mul(&ctx, acc, acc, acc);
+            bit--;
+            continue;
+        }
+
+        low = bit - (long)window + 1;
+        if (low < 0) low = 0;
+        while (!bi_get_bit(exponent, (size_t)low))
+        {
+            low++;
+        }
+
+        value = 0;
+        for (j = (size_t)bit + 1; ok && j > (size_t)low; j--)
+        {
+            value = (value << 1) | (unsigned int)bi_get_bit(exponent, j - 1);
+            if (started) ok = mod_mul(&ctx, acc, acc, acc);
+        }
+
+        if (ok && started)
+        {
+            ok = mod_mul(&ctx, acc, acc, residues + (value >> 1) * n);
+        }
+        else if (ok)
+        {
+            memcpy(acc, residues + (value >> 1) * n, n * sizeof(bi_word));
+            started = true;
+        }
+        bit = low - 1;
+    }
+
+    /* Leaving the Montgomery form is one more reduction of acc * 1 */
+    if (ok && ctx.montgomery)
+    {
+        memcpy(ctx.product, acc, n * sizeof(bi_word));
+        memset(ctx.product + n, 0, n * sizeof(bi_word));
+        ok = mod_reduce(&ctx, acc);
+    }
+
+    x = ok ? bi_from_words(acc, n) : NULL;
+    free(residues);
+    mod_release(&ctx);
+    return x;
+}
+
+/* FACTORIAL HELPERS */
+
+/*
+ * Product of the odd numbers in (lo, hi] for odd lo <= hi, split as a
+ * balanced product tree so that the big multiplications get operands of
+ * similar size. Leaves pack as many factors as fit into one word. The two
+ * halves of big subtrees are computed in parallel.
+ */
+static BigInt* fact_odd_product(uint64_t lo, uint64_t hi);
+
+typedef struct
+{
+    uint64_t lo;
+    uint64_t hi;
+    BigInt* res;
+} FactJob;
+
+static void fact_job_run(void* arg)
+{
+    FactJob* job = (FactJob*)arg;
+
+    job->res = fact_odd_product(job->lo, job->hi);
+}
+
+static BigInt* fact_odd_product(uint64_t lo, uint64_t hi)
+{
+    uint64_t count = (hi - lo) / 2;
+    uint64_t mid, k, acc, bits;
+    BigInt *left, *right, *res;
+    FactJob job;
+    ThreadTask task;
+
+    if (count <= FACT_LEAF_FACTORS)
+    {
+        /* Sized once for count factors of at most bits each */
+        bits = 0;
+        for (k = hi; k > 0; k >>= 1) bits++;
+        res = bi_from_word(1);
+        if (!res || !bi_resize(res, (size_t)(count * bits / BITS_IN_WORD) + 2))
+        {
+            bi_destroy(res);
+            return NULL;
+        }
+
+        acc = 1;
+        for (k = lo + 2; k <= hi; k += 2)
+        {
+            if (acc > WORD_MAX / k)
+            {
+                bi_mul_digit_into(res, (bi_word)acc);
+                acc = k;
+            }
+            else
+            {
+                acc *= k;
+            }
+        }
+        bi_mul_digit_into(res, (bi_word)acc);
+        return res;
+    }
+
+    mid = lo + 2 * (count / 2);
+
+    /* The subtree has about count * log2(hi) bits */
+    bits = 0;
+    for (k = hi; k > 0; k >>= 1) bits++;
+    if (parallel_worth((size_t)(count * bits / BITS_IN_WORD)))
+    {
+        job.lo = mid;
+        job.hi = hi;
+        thread_pool_spawn(&task, fact_job_run, &job);
+        left = fact_odd_product(lo, mid);
+        thread_pool_join(&task);
+        right = job.res;
+    }
+    else
+    {
+        left = fact_odd_product(lo, mid);
+        right = fact_odd_product(mid, hi);
+    }
+    res = bi_mul(left, right);
+
+    bi_destroy(left);
+    bi_destroy(right);
+    return res;
+}
+
+/* MEMORY POOL */
+
+/*
+ * While a pool is active, released digit arrays and BigInt structures are
+ * kept on free lists instead of being returned to the allocator. Digit
+ * arrays are rounded up to power of two size classes so that they can be
+ * reused for any request of their class. Every cached block is an ordinary
+ * malloc() block, so values created under a pool stay valid after it is
+ * destroyed and may be released with or without a pool.
+ */
+
+struct BiPool
+{
+    void* free_words[POOL_CLASSES];  /* Free arrays of 2^(c + POOL_MIN_CLASS) words */
+    void* free_headers;              /* Free BigInt structures */
+    size_t cached_bytes;             /* Bytes held on the free lists */
+};
+
+/* Every thread activates its own pool and counts the value memory handed out to it */
+typedef struct
+{
+    BiPool* pool;
+    size_t allocated_bytes;
+} ThreadState;
+
+/*
+ * C11 _Thread_local or the GCC and MSVC keywords where available. Other
+ * compilers, or BI_NO_THREAD_LOCAL, fall back to a POSIX thread-specific key.
+ */
+#if !defined(BI_NO_THREAD_LOCAL)
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define BI_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define BI_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define BI_THREAD_LOCAL __declspec(thread)
+#endif
+#endif
+
+#ifdef BI_THREAD_LOCAL
+static BI_THREAD_LOCAL ThreadState thread_local_state;
+
+static ThreadState* thread_state(void)
+{
+    return &thread_local_state;
+}
+#else
+static pthread_key_t thread_state_key;
+static pthread_once_t thread_state_once = PTHREAD_ONCE_INIT;
+static ThreadState shared_state;    /* Used by threads whose own state cannot be allocated */
+
+static void thread_state_init(void)
+{
+    pthread_key_create(&thread_state_key, free);
+}
+
+static ThreadState* thread_state(void)
+{
+    ThreadState* state;
+
+    pthread_once(&thread_state_once, thread_state_init);
+    state = (ThreadState*)pthread_getspecific(thread_state_key);
+    if (state) return state;
+
+    state = (ThreadState*)calloc(1, sizeof(ThreadState));
+    if (!state || pthread_setspecific(thread_state_key, state) != 0)
+    {
+        free(state);
+        return &shared_state;
+    }
+    return state;
+}
+#endif
+
+static void* pool_pop(void** list)
+{
+    void* block = *list;
+
+    if (block) *list = *(void**)block;
+    return block;
+}
+
+static void pool_push(void** list, void* block)
+{
+    *(void**)block = *list;
+    *list = block;
+}
+
+/* Size class for an array of words, POOL_CLASSES if it is too large to be pooled */
+static size_t pool_class(size_t words)
+{
+    size_t c = 0;
+
+    while (c < POOL_CLASSES && ((size_t)1 << (c + POOL_MIN_CLASS)) < words)
+    {
+        c++;
+    }
+    return c;
+}
+
+/* Allocates at least required words, the real size is stored into capacity */
+static bi_word* bi_alloc_words(size_t required, size_t* capacity)
+{
+    ThreadState* state = thread_state();
+    size_t c;
+    bi_word* digits;
+
+    if (state->pool)
+    {
+        c = pool_class(required);
+        if (c < POOL_CLASSES)
+        {
+            *capacity = (size_t)1 << (c + POOL_MIN_CLASS);
+            state->allocated_bytes += *capacity * sizeof(bi_word);
+            digits = (bi_word*)pool_pop(&state->pool->free_words[c]);
+            if (digits)
+            {
+                state->pool->cached_bytes -= *capacity * sizeof(bi_word);
+                return digits;
+            }
+            return (bi_word*)malloc(*capacity * sizeof(bi_word));
+        }
+    }
+
+    *capacity = required;
+    state->allocated_bytes += required * sizeof(bi_word);
+    return (bi_word*)malloc(required * sizeof(bi_word));
+}
+
+static void bi_release_words(bi_word* digits, size_t capacity)
+{
+    BiPool* pool;
+    size_t c;
+    size_t bytes = capacity * sizeof(bi_word);
+
+    if (!digits) return;
+
+    pool = thread_state()->pool;
+    if (pool && pool->cached_bytes + bytes <= POOL_MAX_CACHED_BYTES)
+    {
+        c = pool_class(capacity);
+        if (c < POOL_CLASSES && ((size_t)1 << (c + POOL_MIN_CLASS)) == capacity)
+        {
+            pool_push(&pool->free_words[c], digits);
+            pool->cached_bytes += bytes;
+            return;
+        }
+    }
+    free(digits);
+}
+
+static BigInt* bi_alloc_header(void)
+{
+    ThreadState* state = thread_state();
+    BigInt* num = NULL;
+
+    state->allocated_bytes += sizeof(BigInt);
+    if (state->pool)
+    {
+        num = (BigInt*)pool_pop(&state->pool->free_headers);
+    }
+    if (!num)
+    {
+        num = (BigInt*)malloc(sizeof(BigInt));
+    }
+    return num;
+}
+
+static void bi_release_header(BigInt* num)
+{
+    BiPool* pool = thread_state()->pool;
+
+    if (pool)
+    {
+        pool_push(&pool->free_headers, num);
+        return;
+    }
+    free(num);
+}
+
+BiPool* bi_pool_create(void)
+{
+    return (BiPool*)calloc(1, sizeof(BiPool));
+}
+
+void bi_pool_trim(BiPool* pool)
+{
+    void* block;
+    size_t c;
+
+    if (!pool) return;
+
+    for (c = 0; c < POOL_CLASSES; c++)
+    {
+        while ((block = pool_pop(&pool->free_words[c])) != NULL)
+        {
+            free(block);
+        }
+    }
+    while ((block = pool_pop(&pool->free_headers)) != NULL)
+    {
+        free(block);
+    }
+    pool->cached_bytes = 0;
+}
+
+void bi_pool_destroy(BiPool* pool)
+{
+    if (!pool) return;
+
+    if (thread_state()->pool == pool)
+    {
+        thread_state()->pool = NULL;
+    }
+    bi_pool_trim(pool);
+    free(pool);
+}
+
+BiPool* bi_pool_activate(BiPool* pool)
+{
+    ThreadState* state = thread_state();
+    BiPool* previous = state->pool;
+
+    state->pool = pool;
+    return previous;
+}
+
+/* CORE FUNCTIONS */
+
+BigInt* bi_create()
+{
+    BigInt* num = bi_alloc_header();
+
+    if (!num)
+    {
+        return NULL;
+    }
+
+    bi_init(num);
+    return num;
+}
+
+void bi_destroy(BigInt* num)
+{
+    if (!num) return;
+
+    bi_clear(num);
+    bi_release_header(num);
+}
+
+void bi_init(BigInt* num)
+{
+    memset(num->inline_digits, 0, sizeof(num->inline_digits));
+    num->digits = num->inline_digits;
+    num->capacity = BI_INLINE_WORDS;
+    num->sign = 0;
+    num->length = 1;
+}
+
+void bi_clear(BigInt* num)
+{
+    if (!num) return;
+
+    /* A value moved away by bi_move_into() has no digits left */
+    if (num->digits != NULL && num->digits != num->inline_digits)
+    {
+        bi_release_words(num->digits, num->capacity);
+    }
+    bi_init(num);
+}
+
+BigInt* bi_copy(const BigInt* original)
+{
+    BigInt* copy;
+
+    if (!original || !original->digits || original->capacity == 0)
+    {
+        return NULL;
+    }
+
+    copy = bi_alloc_header();
+    if (!copy) return NULL;
+
+    bi_init(copy);
+    if (!bi_resize(copy, original->length))
+    {
+        bi_release_header(copy);
+        return NULL;
+    }
+
+    memcpy(copy->digits, original->digits, original->length * sizeof(bi_word));
+
+    copy->sign = original->sign;
+    copy->length = original->length;
+
+    return copy;
+}
+
+bool bi_resize(BigInt* num, size_t required_capacity)
+{
+    size_t old_capacity;
+    size_t new_capacity;
+    size_t grown;
+    bi_word* new_digits;
+
+    if (!num) return false;
+
+    if (num->capacity >= required_capacity)
+    {
+        return true;
+    }
+
+    /* Geometric growth, the exact size is tried again if the larger block is refused */
+    old_capacity = num->capacity;
+    grown = old_capacity + old_capacity / 2;
+    if (grown < required_capacity) grown = required_capacity;
+
+    if (thread_state()->pool || num->digits == num->inline_digits)
+    {
+        new_digits = bi_alloc_words(grown, &new_capacity);
+        if (!new_digits && grown > required_capacity)
+        {
+            new_digits = bi_alloc_words(required_capacity, &new_capacity);
+        }
+        if (!new_digits)
+        {
+            return false;
+        }
+        memcpy(new_digits, num->digits, old_capacity * sizeof(bi_word));
+        if (num->digits != num->inline_digits)
+        {
+            bi_release_words(num->digits, old_capacity);
+        }
+    }
+    else
+    {
+        new_capacity = grown;
+        new_digits = realloc(num->digits, new_capacity * sizeof(bi_word));
+        if (!new_digits && grown > required_capacity)
+        {
+            new_capacity = required_capacity;
+            new_digits = realloc(num->digits, new_capacity * sizeof(bi_word));
+        }
+        if (!new_digits)
+        {
+            return false;
+        }
+        thread_state()->allocated_bytes += (new_capacity - old_capacity) * sizeof(bi_word);
+    }
+
+    memset(new_digits + old_capacity, 0, (new_capacity - old_capacity) * sizeof(bi_word));
+
+    num->digits = new_digits;
+    num->capacity = new_capacity;
+    return true;
+}
+
+void bi_shrink_to_fit(BigInt* num)
+{
+    size_t c;
+    size_t new_capacity;
+    bi_word* new_digits;
+
+    if (!num || !num->digits || num->digits == num->inline_digits) return;
+
+    if (num->length <= BI_INLINE_WORDS)
+    {
+        memcpy(num->inline_digits, num->digits, num->length * sizeof(bi_word));
+        memset(num->inline_digits + num->length, 0, (BI_INLINE_WORDS - num->length) * sizeof(bi_word));
+        bi_release_words(num->digits, num->capacity);
+        num->digits = num->inline_digits;
+        num->capacity = BI_INLINE_WORDS;
+        return;
+    }
+
+    if (thread_state()->pool)
+    {
+        /* Pooled arrays come in size classes, only a smaller class helps */
+        c = pool_class(num->length);
+        if (c < POOL_CLASSES && ((size_t)1 << (c + POOL_MIN_CLASS)) >= num->capacity) return;
+        if (c == POOL_CLASSES && num->capacity == num->length) return;
+
+        new_digits = bi_alloc_words(num->length, &new_capacity);
+        if (!new_digits) return;
+        memcpy(new_digits, num->digits, num->length * sizeof(bi_word));
+        bi_release_words(num->digits, num->capacity);
+    }
+    else
+    {
+        if (num->capacity == num->length) return;
+        new_capacity = num->length;
+        new_digits = realloc(num->digits, new_capacity * sizeof(bi_word));
+        if (!new_digits) return;
+    }
+
+    num->digits = new_digits;
+    num->capacity = new_capacity;
+}
+
+size_t bi_allocated_bytes(void)
+{
+    return thread_state()->allocated_bytes;
+}
+
+void bi_free_caches(void)
+{
+    /* Callers of dec_power() use the entries unlocked, so none may be converting now */
+    pthread_mutex_lock(&dec_powers_lock);
+    while (dec_powers_count > 0)
+    {
+        bi_destroy(dec_powers[--dec_powers_count]);
+    }
+    pthread_mutex_unlock(&dec_powers_lock);
+}
+
+void bi_set_parallel_threshold(size_t words)
+{
+    parallel_threshold = words;
+}
+
+void bi_normalize(BigInt* num)
+{
+    if (!num) return;
+    if (!num->digits) return;
+
+    /* Deleting null words */
+    while (num->length > 1 && num->digits[num->length - 1] == 0)
+    {
+        num->length--;
+    }
+
+    if (num->length == 1 && num->digits[0] == 0)
+    {
+        num->sign = 0;
+    }
+}
+
+/* HELP MATH FUNCTIONS */
+
+int bi_compare_abs(const BigInt* a, const BigInt* b)
+{
+    size_t i;
+
+    if (!a || !b) return 0;
+
+    if (a->length > b->length) return 1;
+    if (a->length < b->length) return -1;
+
+    for (i = a->length; i > 0; i--)
+    {
+        if (a->digits[i - 1] > b->digits[i - 1]) return 1;
+        if (a->digits[i - 1] < b->digits[i - 1]) return -1;
+    }
+
+    return 0;
+}
+
+int bi_get_bit(const BigInt* n, size_t k)
+{
+    if (!n) return 0;
+
+    size_t digit_idx = k / BITS_IN_WORD;
+    size_t bit_idx = k % BITS_IN_WORD;
+
+    if (digit_idx < n->length) {
+        bi_word digit = n->digits[digit_idx];
+        return (int)((digit >> bit_idx) & 1U);
+    }
+
+    return 0;
+}
+
+size_t bi_bit_length(const BigInt* n)
+{
+    size_t bits;
+    bi_word last_digit;
+
+    if (!n) return 0;
+    if (n->sign == 0) return 0;
+
+    bits = (n->length - 1) * BITS_IN_WORD;
+    last_digit = n->digits[n->length - 1];
+
+    while (last_digit > 0)
+    {
+        last_digit >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+void bi_shift_left_one(BigInt* n)
+{
+    size_t i;
+    bi_word carry = 0;
+    bi_word next_carry;
+
+    if (!n) return;
+    if (n->sign == 0) return;
+    if (!bi_resize(n, n->length + 1)) return;
+
+    for (i = 0; i < n->length; i++)
+    {
+        next_carry = n->digits[i] >> (BITS_IN_WORD - 1);
+        n->digits[i] = (n->digits[i] << 1) | carry;
+        carry = next_carry;
+    }
+    if (carry)
+    {
+        n->digits[n->length] = carry;
+        n->length++;
+    }
+}
+
+BigInt* bi_shift_left(const BigInt* a, size_t bits)
+{
+    size_t words = bits / BITS_IN_WORD;
+    BigInt* res;
+
+    if (!a) return NULL;
+    if (a->sign == 0) return bi_create();
+
+    res = bi_create();
+    if (!res) return NULL;
+    if (!bi_resize(res, a->length + words + 1))
+    {
+        bi_destroy(res);
+        return NULL;
+    }
+
+    memset(res->digits, 0, words * sizeof(bi_word));
+    res->digits[a->length + words] = words_shl(res->digits + words, a->digits, a->length,
+                                               (unsigned int)(bits % BITS_IN_WORD));
+    res->length = a->length + words + 1;
+    res->sign = a->sign;
+    bi_normalize(res);
+    return res;
+}
+
+BigInt* bi_shift_right(const BigInt* a, size_t bits)
+{
+    size_t words = bits / BITS_IN_WORD;
+    BigInt* res;
+
+    if (!a) return NULL;
+    if (a->sign == 0 || words >= a->length) return bi_create();
+
+    res = bi_create();
+    if (!res) return NULL;
+    if (!bi_resize(res, a->length - words))
+    {
+        bi_destroy(res);
+        return NULL;
+    }
+
+    words_shr(res->digits, a->digits + words, a->length - words, (unsigned int)(bits % BITS_IN_WORD));
+    res->length = a->length - words;
+    res->sign = a->sign;
+    bi_normalize(res);
+    return res;
+}
+
+/* CORE MATH FUNCTIONS */
+
+BigInt* bi_add_abs(const BigInt* a, const BigInt* b)
+{
+    BigInt* res = NULL;
+    const BigInt* smaller = NULL;
+
+    if (!a || !b) return NULL;
+
+    if (bi_compare_abs(a, b) >= 0)
+    {
+        res = bi_copy(a);
+        smaller = b;
+    }
+    else
+    {
+        res = bi_copy(b);
+        smaller = a;
+    }
+
+    if (!res) return NULL;
+
+    bi_add_into_abs(res, smaller);
+    return res;
+}
+
+BigInt* bi_sub_abs(const BigInt* a, const BigInt* b)
+{
+    BigInt* result;
+
+    if (!a || !b) return NULL;
+
+    result = bi_copy(a);
+    if (!result) return NULL;
+
+    bi_sub_into_abs(result, b);
+    return result;
+}
+
+void bi_div_mod_abs(const BigInt* a, const BigInt* b, BigInt** quotient, BigInt** remainder)
+{
+    bool ok;
+
+    if (quotient) *quotient = NULL;
+    if (remainder) *remainder = NULL;
+
+    if (!a || !b || b->sign == 0)
+    {
+        return;
+    }
+
+    if (b->length >= BZ_THRESHOLD && a->length >= b->length + BZ_OFFSET)
+    {
+        ok = bi_div_mod_bz(a, b, quotient, remainder);
+    }
+    else
+    {
+        ok = bi_div_mod_basecase(a, b, quotient, remainder);
+    }
+
+    if (!ok && quotient)
+    {
+        bi_destroy(*quotient);
+        *quotient = NULL;
+    }
+    if (!ok && remainder)
+    {
+        bi_destroy(*remainder);
+        *remainder = NULL;
+    }
+}
+
+BigInt* bi_add(const BigInt* a, const BigInt* b)
+{
+    int cmp;
+    BigInt* result;
+
+    if (!a || !b) return NULL;
+
+    if (a->sign == 0) return bi_copy(b);
+    if (b->sign == 0) return bi_copy(a);
+
+    if (a->sign == b->sign)
+    {
+        result = bi_add_abs(a, b);
+        if (!result) return NULL;
+        result->sign = a->sign;
+        return result;
+    }
 
     cmp = bi_compare_abs(a, b);
 
@@ -561,55 +3467,23 @@ BigInt* bi_mul(const BigInt* a, const BigInt* b)
 {
     size_t total_len;
     BigInt* res;
-    size_t i, j, k;
-    uint64_t carry;
-    uint64_t current;
-    uint64_t sum;
-    uint64_t ripple;
 
     if (!a || !b) return NULL;
+    if (a == b) return bi_sqr(a);
     if (a->sign == 0 || b->sign == 0) return bi_create();
 
     total_len = a->length + b->length;
     res = bi_create();
+    if (!res) return NULL;
 
-    if (!bi_resize(res, total_len))
+    if (!bi_resize(res, total_len) ||
+        !words_mul(res->digits, a->digits, a->length, b->digits, b->length))
     {
         bi_destroy(res);
         return NULL;
     }
-
-    memset(res->digits, 0, total_len * sizeof(uint32_t));
     res->length = total_len;
 
-    for (i = 0; i < a->length; i++)
-    {
-        carry = 0;
-        for (j = 0; j < b->length; j++)
-        {
-            current = (uint64_t)a->digits[i] * b->digits[j] +
-                res->digits[i + j] + carry;
-            res->digits[i + j] = (uint32_t)current;
-            carry = current >> BITS_IN_WORD;
-        }
-
-        if (carry)
-        {
-            sum = (uint64_t)res->digits[i + b->length] + carry;
-            res->digits[i + b->length] = (uint32_t)sum;
-
-            k = i + b->length + 1;
-            ripple = sum >> BITS_IN_WORD;
-            while (ripple > 0 && k < res->length)
-            {
-                sum = (uint64_t)res->digits[k] + ripple;
-                res->digits[k] = (uint32_t)sum;
-                ripple = sum >> BITS_IN_WORD;
-                k++;
-            }
-        }
-    }
-
     if (a->sign == b->sign)
     {
         res->sign = 1;
@@ -623,15 +3497,38 @@ BigInt* bi_mul(const BigInt* a, const BigInt* b)
     return res;
 }
 
+BigInt* bi_sqr(const BigInt* a)
+{
+    size_t total_len;
+    BigInt* res;
+
+    if (!a) return NULL;
+    if (a->sign == 0) return bi_create();
+
+    total_len = 2 * a->length;
+    res = bi_create();
+    if (!res) return NULL;
+
+    if (!bi_resize(res, total_len) || !words_sqr(res->digits, a->digits, a->length))
+    {
+        bi_destroy(res);
+        return NULL;
+    }
+    res->length = total_len;
+    res->sign = 1;
+
+    bi_normalize(res);
+    return res;
+}
+
 BigInt* bi_div(const BigInt* a, const BigInt* b)
 {
-    BigInt *q, *r;
+    BigInt* q;
 
     if (!a || !b) return NULL;
     if (b->sign == 0) return NULL;
 
-    bi_div_mod_abs(a, b, &q, &r);
-    bi_destroy(r);
+    bi_div_mod_abs(a, b, &q, NULL);
 
     if (q)
     {
@@ -650,13 +3547,12 @@ BigInt* bi_div(const BigInt* a, const BigInt* b)
 
 BigInt* bi_mod(const BigInt* a, const BigInt* b)
 {
-    BigInt *q, *r;
+    BigInt* r;
 
     if (!a || !b) return NULL;
     if (b->sign == 0) return NULL;
 
-    bi_div_mod_abs(a, b, &q, &r);
-    bi_destroy(q);
+    bi_div_mod_abs(a, b, NULL, &r);
 
     if (r)
     {
@@ -684,153 +3580,555 @@ BigInt* bi_negate(const BigInt* a)
 
 BigInt* bi_pow(const BigInt* base, BigInt* exponent)
 {
+    size_t exp_bits;
+    size_t zeros = 0;
+    size_t shift;
+    size_t table_size;
+    size_t i, j;
+    long bit, low;
+    unsigned int window, value;
+    BigInt* odd;
+    BigInt* odd_sqr;
+    BigInt* table[POW_TABLE_MAX];
+    BigInt* result = NULL;
+    bool negative;
+    bool ok;
+
     if (!base || !exponent) return NULL;
 
     /* Handle special cases */
-    if (exponent->sign == 0) return bi_from_dec("1");
-    if (base->sign == 0) return bi_from_dec("0");
+    if (exponent->sign == 0) return bi_from_word(1);
+    if (base->sign == 0) return bi_create();
+    if (exponent->sign == -1) return bi_create();
 
-    if (exponent->sign == -1) return bi_from_dec("0");
+    exp_bits = bi_bit_length(exponent);
+    negative = base->sign == -1 && bi_get_bit(exponent, 0);
 
-    BigInt* one = bi_from_dec("1");
-    if (!one) return NULL;
+    /* base = odd * 2^zeros, the power of two becomes one final shift */
+    while (base->digits[zeros / BITS_IN_WORD] == 0)
+    {
+        zeros += BITS_IN_WORD;
+    }
+    zeros += BITS_IN_WORD - 1 - word_leading_zeros(base->digits[zeros / BITS_IN_WORD] &
+                                                   ((bi_word)0 - base->digits[zeros / BITS_IN_WORD]));
 
-    if (bi_compare_abs(base, one) == 0)
+    shift = 0;
+    if (zeros > 0)
     {
-        bi_destroy(one);
-        if (base->sign == 1) return bi_from_dec("1");
-        else
+        /* The shift has to fit into size_t, larger results could never be stored */
+        if (exp_bits > sizeof(size_t) * 8 - 1) return NULL;
+        for (bit = (long)exp_bits - 1; bit >= 0; bit--)
         {
-            /* Check if exponent is even */
-            BigInt* two = bi_from_dec("2");
-            if (!two) return NULL;
+            shift = (shift << 1) | (size_t)bi_get_bit(exponent, (size_t)bit);
+        }
+        if (shift > ((size_t)-1) / zeros) return NULL;
+        shift *= zeros;
+    }
 
-            BigInt* mod = bi_mod(exponent, two);
-            BigInt* result = NULL;
+    odd = bi_shift_right(base, zeros);
+    if (!odd) return NULL;
+    odd->sign = 1;
 
-            if (mod && mod->sign == 0)
-            {
-                result = bi_from_dec("1");  /* Even */
-            }
-            else
+    if (odd->length == 1 && odd->digits[0] == 1)
+    {
+        /* Powers of two (and of one) are a pure shift */
+        result = bi_shift_left(odd, shift);
+        bi_destroy(odd);
+        if (result && negative) result->sign = -1;
+        return result;
+    }
+
+    /* Sliding window: odd powers odd^1, odd^3, ... odd^(2^window - 1) are precomputed */
+    window = 1;
+    while (window < POW_WINDOW_MAX && exp_bits > pow_window_bits[window])
+    {
+        window++;
+    }
+    table_size = (size_t)1 << (window - 1);
+
+    table[0] = odd;
+    odd_sqr = table_size > 1 ? bi_sqr(odd) : NULL;
+    ok = table_size == 1 || odd_sqr;
+    for (i = 1; i < table_size; i++)
+    {
+        table[i] = bi_mul(table[i - 1], odd_sqr);
+        if (!table[i]) ok = false;
+    }
+    bi_destroy(odd_sqr);
+
+    bit = (long)exp_bits - 1;
+    while (ok && bit >= 0)
+    {
+        if (!bi_get_bit(exponent, (size_t)bit))
+        {
+            result = bi_replace(result, bi_sqr(result));
+            ok = result != NULL;
+            bit--;
+            continue;
+        }
+
+        /* Longest window ending at a set bit */
+        low = bit - (long)window + 1;
+        if (low < 0) low = 0;
+        while (!bi_get_bit(exponent, (size_t)low))
+        {
+            low++;
+        }
+
+        value = 0;
+        for (j = (size_t)bit + 1; j > (size_t)low; j--)
+        {
+            value = (value << 1) | (unsigned int)bi_get_bit(exponent, j - 1);
+            if (result)
             {
-                result = bi_from_dec("-1"); /* Odd */
+                result = bi_replace(result, bi_sqr(result));
+                if (!result) ok = false;
             }
+        }
+
+        if (ok && result)
+        {
+            result = bi_replace(result, bi_mul(result, table[value >> 1]));
+        }
+        else if (ok)
+        {
+            result = bi_copy(table[value >> 1]);
+        }
+        ok = ok && result != NULL;
+        bit = low - 1;
+    }
+
+    for (i = 0; i < table_size; i++)
+    {
+        bi_destroy(table[i]);
+    }
+
+    if (!ok)
+    {
+        bi_destroy(result);
+        return NULL;
+    }
+
+    if (shift > 0)
+    {
+        result = bi_replace(result, bi_shift_left(result, shift));
+        if (!result) return NULL;
+    }
+    if (negative) result->sign = -1;
+    return result;
+}
+
+BigInt* bi_powmod(const BigInt* base, const BigInt* exponent, const BigInt* modulus)
+{
+    BigInt* result;
+
+    if (!base || !exponent || !modulus || modulus->sign == 0) return NULL;
+
+    /* The special cases of bi_pow(), reduced */
+    if (exponent->sign == -1) return bi_create();
+    if (modulus->length == 1 && modulus->digits[0] == 1) return bi_create();
+    if (exponent->sign == 0) return bi_from_word(1);
+    if (base->sign == 0) return bi_create();
+
+    result = powmod_abs(base, exponent, modulus);
+
+    /* Truncated remainder: the sign of the power */
+    if (result && result->sign != 0 && base->sign == -1 && bi_get_bit(exponent, 0))
+    {
+        result->sign = -1;
+    }
+    return result;
+}
+
+BigInt* bi_mulmod(const BigInt* a, const BigInt* b, const BigInt* modulus)
+{
+    BigInt* reduced[2] = { NULL, NULL };
+    const BigInt* operands[2];
+    BigInt* product;
+    BigInt* r = NULL;
+    int i;
+
+    if (!a || !b || !modulus || modulus->sign == 0) return NULL;
+
+    /* Operands longer than the modulus are reduced first, |a b| mod m is unchanged */
+    operands[0] = a;
+    operands[1] = b;
+    for (i = 0; i < 2; i++)
+    {
+        if (operands[i]->length <= modulus->length) continue;
+
+        bi_div_mod_abs(operands[i], modulus, NULL, &reduced[i]);
+        if (!reduced[i])
+        {
+            bi_destroy(reduced[0]);
+            return NULL;
+        }
+        operands[i] = reduced[i];
+    }
+
+    product = bi_mul(operands[0], operands[1]);
+    bi_destroy(reduced[0]);
+    bi_destroy(reduced[1]);
+    if (!product) return NULL;
+
+    bi_div_mod_abs(product, modulus, NULL, &r);
+    bi_destroy(product);
+
+    /* Truncated remainder: the sign of the product */
+    if (r)
+    {
+        r->sign = a->sign * b->sign;
+        bi_normalize(r);
+    }
+    return r;
+}
+
+BigInt* bi_fact(uint32_t n)
+{
+    BigInt* odd_part;
+    BigInt* partial;
+    BigInt* range;
+    BigInt* res;
+    uint32_t h;
+    uint32_t high;
+    uint32_t prev_high = 1;
+    size_t shift = 0;
+    int i;
+
+    if (n == 0 || n == 1)
+    {
+        return bi_from_word(1);
+    }
+
+    /*
+     * With odd(m) the product of odd numbers up to m, the odd part of n! is
+     * odd(n) * odd(n / 2) * odd(n / 4) * ... and the power of two is
+     * n - popcount(n) (Luschny's split recursive algorithm). The partial
+     * products odd(n >> i) are built incrementally from the top.
+     */
+    odd_part = bi_from_word(1);
+    partial = bi_from_word(1);
+
+    for (i = BITS_IN_WORD - 1 - word_leading_zeros(n); i >= 0; i--)
+    {
+        h = n >> i;
+        high = (h - 1) | 1;
+        if (high > prev_high)
+        {
+            range = fact_odd_product(prev_high, high);
+            partial = bi_replace(partial, bi_mul(partial, range));
+            bi_destroy(range);
+            odd_part = bi_replace(odd_part, bi_mul(odd_part, partial));
+        }
+        if (i > 0) shift += h;
+        prev_high = high;
+    }
+
+    res = bi_shift_left(odd_part, shift);
+    bi_destroy(odd_part);
+    bi_destroy(partial);
+    return res;
+}
+
+/* DESTINATION PASSING FUNCTIONS */
+
+/* Sets the sign of a magnitude, keeping zero unsigned */
+static void bi_apply_sign(BigInt* num, int sign)
+{
+    num->sign = sign;
+    bi_normalize(num);
+}
+
+/* Moves the value of src into dst and releases src */
+static bool bi_move_into(BigInt* dst, BigInt* src)
+{
+    if (!src) return false;
+
+    if (src->digits == src->inline_digits)
+    {
+        /* Inline digits cannot change owner, they fit into any value */
+        memcpy(dst->digits, src->digits, src->length * sizeof(bi_word));
+        dst->length = src->length;
+        dst->sign = src->sign;
+        bi_destroy(src);
+        return true;
+    }
+
+    if (dst->digits != dst->inline_digits)
+    {
+        bi_release_words(dst->digits, dst->capacity);
+    }
+    dst->digits = src->digits;
+    dst->capacity = src->capacity;
+    dst->length = src->length;
+    dst->sign = src->sign;
+
+    src->digits = NULL;
+    bi_destroy(src);
+    return true;
+}
+
+/* res = |a| - |res| for |a| >= |res| */
+static bool bi_rsub_into_abs(BigInt* res, const BigInt* a)
+{
+    size_t old_length = res->length;
+
+    if (!bi_resize(res, a->length)) return false;
+
+    words_sub(res->digits, a->digits, a->length, res->digits, old_length);
+    res->length = a->length;
+    bi_normalize(res);
+    return true;
+}
+
+/* dst = a + sign * |b|, any of the operands may be dst */
+static bool bi_add_signed_to(BigInt* dst, const BigInt* a, const BigInt* b, int b_sign)
+{
+    int a_sign = a->sign;
+    int cmp;
+    bool ok;
+
+    if (b_sign == 0) return bi_set(dst, a);
+    if (a_sign == 0)
+    {
+        if (!bi_set(dst, b)) return false;
+        dst->sign = b_sign;
+        return true;
+    }
+
+    if (a_sign == b_sign)
+    {
+        if (dst == b)
+        {
+            ok = bi_add_into_abs(dst, a);
+        }
+        else
+        {
+            /* Sized for the carry up front, bi_set() would grow it only to |a| */
+            ok = bi_resize(dst, (a->length > b->length ? a->length : b->length) + 1) &&
+                 bi_set(dst, a) && bi_add_into_abs(dst, b);
+        }
+        if (ok) bi_apply_sign(dst, a_sign);
+        return ok;
+    }
+
+    cmp = bi_compare_abs(a, b);
+    if (cmp == 0)
+    {
+        return bi_set(dst, NULL);
+    }
+
+    if (cmp > 0)
+    {
+        /* |a| - |b| with the sign of a */
+        if (dst == b)
+        {
+            ok = bi_rsub_into_abs(dst, a);
+        }
+        else
+        {
+            ok = bi_set(dst, a);
+            if (ok) bi_sub_into_abs(dst, b);
+        }
+        if (ok) bi_apply_sign(dst, a_sign);
+    }
+    else
+    {
+        /* |b| - |a| with the sign of b */
+        if (dst == a)
+        {
+            ok = bi_rsub_into_abs(dst, b);
+        }
+        else
+        {
+            ok = bi_set(dst, b);
+            if (ok) bi_sub_into_abs(dst, a);
+        }
+        if (ok) bi_apply_sign(dst, b_sign);
+    }
+    return ok;
+}
+
+bool bi_set(BigInt* dst, const BigInt* src)
+{
+    if (!dst) return false;
+    if (dst == src) return true;
+
+    if (!src || src->sign == 0)
+    {
+        dst->digits[0] = 0;
+        dst->length = 1;
+        dst->sign = 0;
+        return true;
+    }
+
+    if (!bi_resize(dst, src->length)) return false;
+
+    memcpy(dst->digits, src->digits, src->length * sizeof(bi_word));
+    dst->length = src->length;
+    dst->sign = src->sign;
+    return true;
+}
+
+bool bi_add_to(BigInt* dst, const BigInt* a, const BigInt* b)
+{
+    if (!dst || !a || !b) return false;
+    return bi_add_signed_to(dst, a, b, b->sign);
+}
+
+bool bi_sub_to(BigInt* dst, const BigInt* a, const BigInt* b)
+{
+    if (!dst || !a || !b) return false;
+    return bi_add_signed_to(dst, a, b, -b->sign);
+}
+
+bool bi_mul_to(BigInt* dst, const BigInt* a, const BigInt* b)
+{
+    bi_word digit;
+    int sign;
+
+    if (!dst || !a || !b) return false;
+
+    if (a->sign == 0 || b->sign == 0)
+    {
+        return bi_set(dst, NULL);
+    }
+    sign = a->sign == b->sign ? 1 : -1;
+
+    /* A single word factor is applied in place */
+    if (b->length == 1 && dst != b)
+    {
+        digit = b->digits[0];
+        if (!bi_resize(dst, a->length + 1) || !bi_set(dst, a)) return false;
+        bi_mul_digit_into(dst, digit);
+        bi_apply_sign(dst, sign);
+        return true;
+    }
+    if (a->length == 1 && dst != a)
+    {
+        digit = a->digits[0];
+        if (!bi_resize(dst, b->length + 1) || !bi_set(dst, b)) return false;
+        bi_mul_digit_into(dst, digit);
+        bi_apply_sign(dst, sign);
+        return true;
+    }
+
+    return bi_move_into(dst, bi_mul(a, b));
+}
+
+bool bi_sqr_to(BigInt* dst, const BigInt* a)
+{
+    if (!dst || !a) return false;
+    return bi_move_into(dst, bi_sqr(a));
+}
 
-            if (mod) bi_destroy(mod);
-            bi_destroy(two);
-            return result;
-        }
-    }
-    bi_destroy(one);
+bool bi_div_to(BigInt* dst, const BigInt* a, const BigInt* b)
+{
+    int sign;
 
-    /* Exponentiation by squaring algorithm */
-    BigInt* result = bi_from_dec("1");
-    BigInt* current = bi_copy(base);
-    BigInt* n = bi_copy(exponent);
-    BigInt* zero = bi_from_dec("0");
-    BigInt* two = bi_from_dec("2");
+    if (!dst || !a || !b || b->sign == 0) return false;
 
-    if (!result || !current || !n || !zero || !two)
-    {
-        bi_destroy(result);
-        bi_destroy(current);
-        bi_destroy(n);
-        bi_destroy(zero);
-        bi_destroy(two);
-        return NULL;
-    }
+    sign = a->sign == b->sign ? 1 : -1;
 
-    while (bi_compare_abs(n, zero) > 0)
+    /* Single word divisors are handled in place */
+    if (b->length == 1 && dst != b)
     {
-        BigInt* mod = bi_mod(n, two);
-        if (!mod)
-        {
-            bi_destroy(result);
-            bi_destroy(current);
-            bi_destroy(n);
-            bi_destroy(zero);
-            bi_destroy(two);
-            return NULL;
-        }
+        bi_word divisor = b->digits[0];
 
-        bool is_odd = (mod->sign != 0);
-        bi_destroy(mod);
+        if (!bi_set(dst, a)) return false;
+        words_divmod_1(dst->digits, dst->digits, dst->length, divisor);
+        bi_apply_sign(dst, sign);
+        return true;
+    }
 
-        if (is_odd)
-        {
-            BigInt* temp = bi_mul(result, current);
-            if (!temp)
-            {
-                bi_destroy(result);
-                bi_destroy(current);
-                bi_destroy(n);
-                bi_destroy(zero);
-                bi_destroy(two);
-                return NULL;
-            }
-            bi_destroy(result);
-            result = temp;
-        }
+    return bi_move_into(dst, bi_div(a, b));
+}
 
-        /* n = n / 2 */
-        BigInt* new_n = bi_div(n, two);
-        if (!new_n)
-        {
-            bi_destroy(result);
-            bi_destroy(current);
-            bi_destroy(n);
-            bi_destroy(zero);
-            bi_destroy(two);
-            return NULL;
-        }
-        bi_destroy(n);
-        n = new_n;
+bool bi_mod_to(BigInt* dst, const BigInt* a, const BigInt* b)
+{
+    bi_word remainder;
 
-        if (bi_compare_abs(n, zero) <= 0) break;
+    if (!dst || !a || !b || b->sign == 0) return false;
 
-        /* current = current * current */
-        BigInt* temp = bi_mul(current, current);
-        if (!temp)
-        {
-            bi_destroy(result);
-            bi_destroy(current);
-            bi_destroy(n);
-            bi_destroy(zero);
-            bi_destroy(two);
-            return NULL;
-        }
-        bi_destroy(current);
-        current = temp;
+    /* Single word divisors only need the running remainder */
+    if (b->length == 1)
+    {
+        remainder = words_mod_1(a->digits, a->length, b->digits[0]);
+        dst->digits[0] = remainder;
+        dst->length = 1;
+        bi_apply_sign(dst, a->sign);
+        return true;
     }
 
-    bi_destroy(current);
-    bi_destroy(n);
-    bi_destroy(zero);
-    bi_destroy(two);
+    return bi_move_into(dst, bi_mod(a, b));
+}
 
-    return result;
+bool bi_pow_to(BigInt* dst, const BigInt* base, BigInt* exponent)
+{
+    if (!dst || !base || !exponent) return false;
+    return bi_move_into(dst, bi_pow(base, exponent));
 }
 
-BigInt* bi_fact(uint32_t n)
+bool bi_powmod_to(BigInt* dst, const BigInt* base, const BigInt* exponent, const BigInt* modulus)
 {
-    BigInt* res;
-    uint32_t i;
+    if (!dst || !base || !exponent || !modulus) return false;
+    return bi_move_into(dst, bi_powmod(base, exponent, modulus));
+}
 
-    if (n == 0 || n == 1)
+bool bi_mulmod_to(BigInt* dst, const BigInt* a, const BigInt* b, const BigInt* modulus)
+{
+    if (!dst || !a || !b || !modulus) return false;
+    return bi_move_into(dst, bi_mulmod(a, b, modulus));
+}
+
+bool bi_negate_to(BigInt* dst, const BigInt* a)
+{
+    if (!dst || !a) return false;
+    if (!bi_set(dst, a)) return false;
+
+    dst->sign = -dst->sign;
+    return true;
+}
+
+/* Applies a destination passing operation to every item, under a shared pool if none is active */
+static bool bi_batch_to(bool (*op)(BigInt*, const BigInt*, const BigInt*),
+                        BigInt* const* dst, const BigInt* const* a, const BigInt* const* b, size_t count)
+{
+    BiPool* pool = NULL;
+    BiPool* previous = NULL;
+    bool ok = true;
+    size_t i;
+
+    if (count == 0) return true;
+    if (!dst || !a || !b) return false;
+
+    if (!thread_state()->pool)
     {
-        return bi_from_dec("1");
+        pool = bi_pool_create();
+        previous = bi_pool_activate(pool);
     }
-    res = bi_create();
-    res->digits[0] = 1;
-    res->sign = 1;
 
-    for (i = 2; i <= n; i++)
+    for (i = 0; i < count; i++)
     {
-        bi_mul_digit_into(res, i);
+        if (!op(dst[i], a[i], b[i])) ok = false;
     }
 
-    return res;
+    if (pool)
+    {
+        bi_pool_activate(previous);
+        bi_pool_destroy(pool);
+    }
+    return ok;
+}
+
+bool bi_add_batch(BigInt* const* dst, const BigInt* const* a, const BigInt* const* b, size_t count)
+{
+    return bi_batch_to(bi_add_to, dst, a, b, count);
+}
+
+bool bi_mul_batch(BigInt* const* dst, const BigInt* const* a, const BigInt* const* b, size_t count)
+{
+    return bi_batch_to(bi_mul_to, dst, a, b, count);
 }
 
 /* CONVERSIONS */
@@ -888,23 +4186,25 @@ BigInt* bi_from_str(const char* str)
 
 BigInt* bi_from_hex(const char* str)
 {
-    size_t n;
+    if (!str) return NULL;
+    return bi_from_hex_n(str, strlen(str));
+}
+
+BigInt* bi_from_hex_n(const char* str, size_t n)
+{
     size_t required_digits;
     BigInt* num;
     size_t i;
     size_t digit_index = 0;
-    uint32_t current_digit;
-    uint32_t shift;
+    bi_word current_digit;
+    bi_word shift;
     int j;
-    int val;
     int first_val;
     size_t bits_used;
-    uint32_t mask;
+    bi_word mask;
     size_t k;
 
-    n = strlen(str);
-
-    if (!str || *str == '\0') return NULL;
+    if (!str || n == 0) return NULL;
 
     for (i = 0; i < n; i++)
     {
@@ -914,7 +4214,7 @@ BigInt* bi_from_hex(const char* str)
         }
     }
 
-    required_digits = (n + 7) / HEX_WIDTH;
+    required_digits = (n + HEX_WIDTH - 1) / HEX_WIDTH;
 
     num = bi_create();
     if (!num) return NULL;
@@ -924,11 +4224,9 @@ BigInt* bi_from_hex(const char* str)
         bi_destroy(num);
         return NULL;
     }
-    memset(num->digits, 0, num->capacity * sizeof(uint32_t));
+    memset(num->digits, 0, num->capacity * sizeof(bi_word));
     num->length = required_digits;
 
-    num->sign = 1;
-
     i = n;
     while (i > 0)
     {
@@ -938,13 +4236,7 @@ BigInt* bi_from_hex(const char* str)
         for (j = 0; j < HEX_WIDTH && i > 0; j++)
         {
             i--;
-            val = hex_value(str[i]);
-            if (val == -1)
-            {
-                bi_destroy(num);
-                return NULL;
-            }
-            current_digit |= ((uint32_t)val << shift);
+            current_digit |= ((bi_word)hex_value(str[i]) << shift);
             shift += 4;
         }
         num->digits[digit_index++] = current_digit;
@@ -961,7 +4253,7 @@ BigInt* bi_from_hex(const char* str)
 
         if (bits_used < BITS_IN_WORD)
         {
-            mask = 0xFFFFFFFF << bits_used;
+            mask = WORD_MAX << bits_used;
             num->digits[num->length - 1] |= mask;
         }
 
@@ -979,60 +4271,71 @@ BigInt* bi_from_hex(const char* str)
 }
 
 BigInt* bi_from_dec(const char* str)
+{
+    if (!str) return NULL;
+    return bi_from_dec_n(str, strlen(str));
+}
+
+BigInt* bi_from_dec_n(const char* str, size_t n)
 {
     BigInt* res;
-    const char* p;
+    char* digits;
+    size_t count = 0;
+    size_t i;
 
-    if (!str || *str == '\0') return NULL;
+    if (!str || n == 0) return NULL;
 
-    res = bi_create();
-    if (!res) return NULL;
+    /* Characters other than digits are skipped */
+    for (i = 0; i < n; i++)
+    {
+        if (str[i] >= '0' && str[i] <= '9') count++;
+    }
 
-    p = str;
-    while (*p)
+    /* Plain digits are read in place */
+    if (count == n)
     {
-        if (*p >= '0' && *p <= '9')
-        {
-            bi_mul_digit_into(res, BASE_DEC);
-            bi_add_digit_into(res, *p - '0');
-        }
-        p++;
+        return dec_read_rec(str, n);
     }
 
-    bi_normalize(res);
+    digits = (char*)malloc(count + 1);
+    if (!digits) return NULL;
+
+    count = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (str[i] >= '0' && str[i] <= '9') digits[count++] = str[i];
+    }
+
+    res = dec_read_rec(digits, count);
+    free(digits);
     return res;
 }
 
 BigInt* bi_from_bin(const char* str)
 {
-    const char* p;
-    size_t n;
+    if (!str) return NULL;
+
+    if (str[0] == '0' && (str[1] == 'b' || str[1] == 'B')) str += 2;
+    return bi_from_bin_n(str, strlen(str));
+}
+
+BigInt* bi_from_bin_n(const char* str, size_t n)
+{
     BigInt* res;
     size_t needed_words;
+    size_t bits_used;
     size_t i;
-    size_t bit;
-    size_t word_idx;
-    size_t bit_idx;
-    size_t z;
-
-    if (!str) return NULL;
 
-    p = str;
-    if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) p += 2;
+    if (!str || n == 0) return NULL;
 
-    const char* check = p;
-    while (*check != '\0')
+    for (i = 0; i < n; i++)
     {
-        if (*check != '0' && *check != '1')
+        if (str[i] != '0' && str[i] != '1')
         {
             return NULL;
         }
-        check++;
     }
 
-    n = strlen(p);
-    if (n == 0) return NULL;
-
     res = bi_create();
     if (!res) return NULL;
 
@@ -1042,34 +4345,31 @@ BigInt* bi_from_bin(const char* str)
         bi_destroy(res);
         return NULL;
     }
-
+    memset(res->digits, 0, res->capacity * sizeof(bi_word));
+    res->length = needed_words;
     res->sign = 1;
 
+    /* The last char is the lowest bit */
     for (i = 0; i < n; i++)
     {
-        bi_shift_left_one(res);
-        if (p[i] == '1')
+        if (str[n - 1 - i] == '1')
         {
-            res->digits[0] |= 1;
-            res->sign = 1;
+            res->digits[i / BITS_IN_WORD] |= (bi_word)1 << (i % BITS_IN_WORD);
         }
     }
 
-    if (p[0] == '1')
+    /* A leading one is the sign bit of a two's complement value */
+    if (str[0] == '1')
     {
-        for (bit = n; bit < res->capacity * BITS_IN_WORD; bit++)
+        bits_used = n % BITS_IN_WORD;
+        if (bits_used > 0)
         {
-            word_idx = bit / BITS_IN_WORD;
-            bit_idx = bit % BITS_IN_WORD;
-            if (word_idx < res->length)
-            {
-                res->digits[word_idx] |= (1U << bit_idx);
-            }
+            res->digits[needed_words - 1] |= WORD_MAX << bits_used;
         }
 
-        for (z = 0; z < res->length; z++)
+        for (i = 0; i < needed_words; i++)
         {
-            res->digits[z] = ~res->digits[z];
+            res->digits[i] = ~res->digits[i];
         }
 
         bi_add_digit_into(res, 1);
@@ -1082,157 +4382,209 @@ BigInt* bi_from_bin(const char* str)
 
 char* bi_to_dec(const BigInt* n)
 {
-    BigInt* copy;
-    size_t max_digits;
-    char* buffer;
-    int written = 0;
-    uint32_t remainder;
     char* result;
-    int v = 0;
-    int i;
 
     if (!n) return NULL;
-    if (n->sign == 0) return custom_strdup("0");
 
-    copy = bi_copy(n);
-    if (!copy) return NULL;
-    copy->sign = 1;
+    result = (char*)malloc(bi_dec_size(n) + 1);
+    if (!result) return NULL;
 
-    max_digits = (n->length * BASE_DEC) + 2;
-    buffer = (char*)malloc(max_digits);
-    if (!buffer)
+    if (bi_format_dec(n, result) == 0)
     {
-        bi_destroy(copy);
+        free(result);
         return NULL;
     }
+    return result;
+}
+
+size_t bi_dec_size(const BigInt* n)
+{
+    size_t bits;
+
+    if (!n || n->sign == 0) return 1;
+
+    /* log10(2) < 0.30103, so this never underestimates */
+    bits = bi_bit_length(n);
+    return bits / 100000 * 30103 + (bits % 100000) * 30103 / 100000 + 1 + (n->sign == -1);
+}
 
-    while (copy->sign != 0)
+size_t bi_format_dec(const BigInt* n, char* out)
+{
+    size_t bits;
+    size_t k = 0;
+    size_t pos = 0;
+    const BigInt* power;
+    bool ok = true;
+
+    if (!n || !out) return 0;
+    if (n->sign == 0)
     {
-        remainder = bi_div10_into(copy);
-        buffer[written++] = (char)(remainder + '0');
+        memcpy(out, "0", 2);
+        return 1;
     }
 
-    result = (char*)malloc(written + 2);
-    if (!result)
+    if (n->sign == -1) out[pos++] = '-';
+
+    if (n->length < DEC_DC_THRESHOLD)
     {
-        free(buffer);
-        bi_destroy(copy);
-        return NULL;
+        pos += dec_write_basecase(n, out + pos, 0);
+        ok = pos > (size_t)(n->sign == -1);
+    }
+    else
+    {
+        /* Smallest k with |n| < 10^(DEC_CHUNK_DIGITS * 2^(k + 1)) */
+        bits = bi_bit_length(n);
+        while ((power = dec_power(k)) != NULL && 2 * bi_bit_length(power) - 2 < bits)
+        {
+            k++;
+        }
+        ok = power != NULL;
+        if (ok) pos += dec_write_rec(n, k, out + pos, false, &ok);
     }
 
-    if (n->sign == -1) result[v++] = '-';
+    if (!ok) return 0;
+    out[pos] = '\0';
+    return pos;
+}
+
+/* Initializes a caller owned BigInt to a size, which may be wider than a word */
+static void bi_init_size(BigInt* num, size_t value)
+{
+    size_t i = 0;
 
-    for (i = written - 1; i >= 0; i--)
+    bi_init(num);
+    while (value > 0 && i < BI_INLINE_WORDS)
     {
-        result[v++] = buffer[i];
+        num->digits[i++] = (bi_word)value;
+        value = value >> (BITS_IN_WORD - 1) >> 1;
     }
-    result[v] = '\0';
+    num->length = i > 0 ? i : 1;
+    num->sign = i > 0;
+}
 
-    free(buffer);
-    bi_destroy(copy);
-    return result;
+/* Decimal text of |n| / 10^k (quotient only) or |n| mod 10^k (remainder only) */
+static char* dec_part(const BigInt* n, size_t k, bool remainder)
+{
+    BigInt ten, exponent;
+    BigInt* power;
+    BigInt* part = NULL;
+    char* text;
+
+    bi_init_word(&ten, BASE_DEC);
+    bi_init_size(&exponent, k);
+    power = bi_pow(&ten, &exponent);
+    bi_clear(&exponent);
+    if (!power) return NULL;
+
+    if (remainder) bi_div_mod_abs(n, power, NULL, &part);
+    else bi_div_mod_abs(n, power, &part, NULL);
+    bi_destroy(power);
+    if (!part) return NULL;
+
+    part->sign = part->sign != 0;
+    text = bi_to_dec(part);
+    bi_destroy(part);
+    return text;
 }
 
-char* bi_to_hex(const BigInt* n)
+char* bi_to_dec_summary(const BigInt* n, size_t edge)
 {
-    BigInt* working;
-    size_t i;
-    size_t hex_len;
-    char* raw_buffer;
-    int j;
-    char* start;
-    char next;
-    bool next_is_negative_marker;
+    size_t bits, low, digits, head_length;
+    char* head = NULL;
+    char* tail = NULL;
+    char* text = NULL;
     char* result;
+    size_t tail_length;
+    int written;
 
     if (!n) return NULL;
-    if (n->sign == 0) return custom_strdup("0x0");
+    if (edge == 0) edge = 1;
 
-    working = bi_copy(n);
-    if (!working) return NULL;
+    /* Lower bound of the digit count: 2^(bits - 1) <= |n| and 0.30102 < log10(2) */
+    bits = bi_bit_length(n);
+    low = bits == 0 ? 1 : (bits - 1) / 100000 * 30102 + (bits - 1) % 100000 * 30102 / 100000 + 1;
 
-    if (n->sign == -1)
+    if (low <= 2 * edge || n->length < DEC_DC_THRESHOLD)
     {
-        for (i = 0; i < working->length; i++)
+        /* Small enough for the basecase conversion */
+        text = bi_to_dec(n);
+        if (!text) return NULL;
+        digits = strlen(text) - (n->sign == -1);
+        if (digits <= 2 * edge)
         {
-            working->digits[i] = ~working->digits[i];
+            result = (char*)malloc(strlen(text) + 48);
+            if (result) sprintf(result, "%s (%lu digit%s)", text, (unsigned long)digits, digits == 1 ? "" : "s");
+            free(text);
+            return result;
         }
-        bi_add_digit_into(working, 1);
+        head = text + (n->sign == -1);
+        head_length = digits;
+        tail = head + digits - edge;
     }
-
-    hex_len = working->length * HEX_WIDTH;
-    raw_buffer = (char*)malloc(hex_len + 1);
-    if (!raw_buffer)
+    else
     {
-        bi_destroy(working);
-        return NULL;
+        /* |n| / 10^(low - edge) has at least edge digits, the rest of the count is in its length */
+        head = dec_part(n, low - edge, false);
+        tail = dec_part(n, edge, true);
+        if (!head || !tail)
+        {
+            free(head);
+            free(tail);
+            return NULL;
+        }
+        head_length = strlen(head);
+        digits = low - edge + head_length;
     }
 
-    for (j = (int)working->length - 1; j >= 0; j--)
+    result = (char*)malloc(2 * edge + 64);
+    if (result)
     {
-        sprintf(raw_buffer + (working->length - 1 - j) * HEX_WIDTH, "%08x", working->digits[j]);
+        /* The trailing digits are zero padded to their full width */
+        tail_length = strlen(tail);
+        written = sprintf(result, "%s%.*s...", n->sign == -1 ? "-" : "", (int)edge, head);
+        memset(result + written, '0', edge - tail_length);
+        sprintf(result + written + (edge - tail_length), "%s (%lu digits)", tail, (unsigned long)digits);
     }
 
-    start = raw_buffer;
-
-    if (n->sign == 1)
+    if (text)
     {
-        char* original_start = start;
-        /* Skip leading zeros but keep at least one digit */
-        while (*start == '0' && *(start + 1) != '\0')
-        {
-            start++;
-        }
-
-        /* Check if first character is 8-f or A-F */
-        char first_char = *start;
-        int needs_leading_zero = 0;
-
-        if ((first_char >= '8' && first_char <= '9') ||
-            (first_char >= 'a' && first_char <= 'f') ||
-            (first_char >= 'A' && first_char <= 'F'))
-        {
-            needs_leading_zero = 1;
-        }
-
-        if (needs_leading_zero && start != original_start)
-        {
-            start--;
-        }
+        free(text);
     }
     else
     {
-        while (*start == 'f')
-        {
-            next = *(start + 1);
+        free(head);
+        free(tail);
+    }
+    return result;
+}
 
-            if (next == '\0') break;
+char* bi_to_hex(const BigInt* n)
+{
+    BigInt* working;
+    size_t top, pos = 0;
+    bool leading_zero;
+    char* result;
 
-            next_is_negative_marker = (next >= '8' && next <= '9') ||
-                (next >= 'a' && next <= 'f') ||
-                (next >= 'A' && next <= 'F');
+    if (!n) return NULL;
+    if (n->sign == 0) return custom_strdup("0x0");
 
-            if (next_is_negative_marker)
-            {
-                start++;
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
+    working = complement_for_output(n);
+    if (!working) return NULL;
 
-    result = (char*)malloc(strlen(start) + 3);
+    top = hex_top_digit(n, working, &leading_zero);
+    result = (char*)malloc(top + 5);
     if (!result)
     {
-        free(raw_buffer);
         bi_destroy(working);
         return NULL;
     }
-    sprintf(result, "0x%s", start);
 
-    free(raw_buffer);
+    result[pos++] = '0';
+    result[pos++] = 'x';
+    if (leading_zero) result[pos++] = '0';
+    hex_emit(working, top, top + 1, result + pos);
+    result[pos + top + 1] = '\0';
+
     bi_destroy(working);
     return result;
 }
@@ -1240,96 +4592,206 @@ char* bi_to_hex(const BigInt* n)
 char* bi_to_bin(const BigInt* n)
 {
     BigInt* working;
-    char* buffer;
-    char* start;
+    size_t top, pos = 0;
     char* result;
-    size_t bit_len;
-    size_t total_bits;
-    int pos;
-    int i;
-    size_t z;
 
     if (!n) return NULL;
     if (n->sign == 0) return custom_strdup("0b0");
 
-    working = bi_copy(n);
+    working = complement_for_output(n);
     if (!working) return NULL;
 
-    if (n->sign == -1)
-    {
-        for (z = 0; z < working->length; z++)
-        {
-            working->digits[z] = ~working->digits[z];
-        }
-        bi_add_digit_into(working, 1);
-        working->sign = 1;
-    }
-
-    bit_len = bi_bit_length(working);
-    total_bits = bit_len + 1;
-
-    buffer = (char*)malloc(total_bits + 1);
-    if (!buffer)
+    /* Exact size: the prefix, a zero for positive numbers, the bits and the terminator */
+    top = bin_top_bit(n, working);
+    result = (char*)malloc(top + 5);
+    if (!result)
     {
         bi_destroy(working);
         return NULL;
     }
 
-    pos = 0;
+    result[pos++] = '0';
+    result[pos++] = 'b';
+    if (n->sign == 1) result[pos++] = '0';
+    bin_emit(working, top, top + 1, result + pos);
+    result[pos + top + 1] = '\0';
 
-    if (n->sign == 1)
+    bi_destroy(working);
+    return result;
+}
+
+bool bi_write_dec(const BigInt* n, FILE* f)
+{
+    BlockWriter w;
+    const BigInt* power;
+    size_t bits;
+    size_t k = 0;
+
+    if (!n || !f) return false;
+
+    w.f = f;
+    w.used = 0;
+    w.ok = true;
+
+    if (n->sign == 0)
     {
-        buffer[pos] = '0';
+        writer_put(&w, '0');
     }
     else
     {
-        buffer[pos] = '1';
-    }
-    pos++;
+        if (n->sign == -1) writer_put(&w, '-');
 
-    for (i = (int)bit_len - 1; i >= 0; i--)
-    {
-        int bit = bi_get_bit(working, i);
-        if (bit)
-        {
-            buffer[pos] = '1';
-        }
-        else
+        /* Smallest k with |n| < 10^(DEC_CHUNK_DIGITS * 2^(k + 1)), as in bi_to_dec() */
+        bits = bi_bit_length(n);
+        while ((power = dec_power(k)) != NULL && 2 * bi_bit_length(power) - 2 < bits)
         {
-            buffer[pos] = '0';
+            k++;
         }
-        pos++;
+        if (!power) w.ok = false;
+        dec_stream_rec(n, k, false, &w);
     }
-    buffer[pos] = '\0';
 
-    start = buffer;
+    writer_flush(&w);
+    return w.ok;
+}
 
-    if (n->sign == 1)
-    {
-        while (start[0] == '0' && start[1] == '0')
-        {
-            start++;
-        }
-    }
-    else
+bool bi_write_hex(const BigInt* n, FILE* f)
+{
+    BlockWriter w;
+    BigInt* working;
+    size_t top;
+    bool leading_zero;
+
+    if (!n || !f) return false;
+
+    w.f = f;
+    w.used = 0;
+    w.ok = true;
+
+    writer_put(&w, '0');
+    writer_put(&w, 'x');
+    if (n->sign == 0)
     {
-        while (start[0] == '1' && start[1] == '1')
-        {
-            start++;
-        }
+        writer_put(&w, '0');
+        writer_flush(&w);
+        return w.ok;
     }
 
-    result = (char*)malloc(strlen(start) + 3);
-    if (!result)
+    working = complement_for_output(n);
+    if (!working) return false;
+
+    top = hex_top_digit(n, working, &leading_zero);
+    if (leading_zero) writer_put(&w, '0');
+    writer_emit(&w, working, top, hex_emit);
+
+    bi_destroy(working);
+    writer_flush(&w);
+    return w.ok;
+}
+
+bool bi_write_bin(const BigInt* n, FILE* f)
+{
+    BlockWriter w;
+    BigInt* working;
+    size_t top;
+
+    if (!n || !f) return false;
+
+    w.f = f;
+    w.used = 0;
+    w.ok = true;
+
+    writer_put(&w, '0');
+    writer_put(&w, 'b');
+    if (n->sign == 0)
     {
-        free(buffer);
-        bi_destroy(working);
-        return NULL;
+        writer_put(&w, '0');
+        writer_flush(&w);
+        return w.ok;
     }
 
-    sprintf(result, "0b%s", start);
+    working = complement_for_output(n);
+    if (!working) return false;
+
+    top = bin_top_bit(n, working);
+    if (n->sign == 1) writer_put(&w, '0');
+    writer_emit(&w, working, top, bin_emit);
 
-    free(buffer);
     bi_destroy(working);
-    return result;
+    writer_flush(&w);
+    return w.ok;
+}
+
+size_t bi_raw_size(const BigInt* n)
+{
+    return BI_RAW_HEADER_SIZE + raw_limb_count(n) * BI_RAW_LIMB_SIZE;
+}
+
+unsigned char* bi_to_raw(const BigInt* n, size_t* size)
+{
+    unsigned char* data;
+
+    if (!n) return NULL;
+
+    data = (unsigned char*)malloc(bi_raw_size(n));
+    if (!data) return NULL;
+
+    raw_write_header(n, data);
+    raw_write_limbs(n, data + BI_RAW_HEADER_SIZE);
+    if (size) *size = bi_raw_size(n);
+    return data;
+}
+
+BigInt* bi_from_raw(const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t count;
+    int sign;
+
+    if (!bytes || size < BI_RAW_HEADER_SIZE) return NULL;
+    if (!raw_read_header(bytes, &sign, &count)) return NULL;
+    if (count > (size - BI_RAW_HEADER_SIZE) / BI_RAW_LIMB_SIZE) return NULL;
+
+    return raw_read_limbs(bytes + BI_RAW_HEADER_SIZE, count, sign);
+}
+
+bool bi_write_raw(const BigInt* n, FILE* f)
+{
+    unsigned char* data;
+    size_t size;
+    bool ok;
+
+    if (!n || !f) return false;
+
+    data = bi_to_raw(n, &size);
+    if (!data) return false;
+
+    ok = fwrite(data, 1, size, f) == size;
+    free(data);
+    return ok;
+}
+
+BigInt* bi_read_raw(FILE* f)
+{
+    unsigned char header[BI_RAW_HEADER_SIZE];
+    unsigned char* limbs;
+    BigInt* num;
+    size_t count;
+    int sign;
+
+    if (!f) return NULL;
+    if (fread(header, 1, BI_RAW_HEADER_SIZE, f) != BI_RAW_HEADER_SIZE) return NULL;
+    if (!raw_read_header(header, &sign, &count)) return NULL;
+    if (count > ((size_t)-1) / BI_RAW_LIMB_SIZE) return NULL;
+
+    limbs = (unsigned char*)malloc(count * BI_RAW_LIMB_SIZE + 1);
+    if (!limbs) return NULL;
+
+    num = NULL;
+    if (fread(limbs, 1, count * BI_RAW_LIMB_SIZE, f) == count * BI_RAW_LIMB_SIZE)
+    {
+        num = raw_read_limbs(limbs, count, sign);
+    }
+    free(limbs);
+    return num;
 }
@@ -8,28 +8,103 @@
 #ifndef BIGINT_H
 #define BIGINT_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-extern bool g_error_already_printed;
+/*
+ * Width of one digit word in bits. 64-bit words need a compiler providing
+ * unsigned __int128 for the double word intermediates; elsewhere, or when
+ * built with -DBI_WORD_BITS=32, 32-bit words with uint64_t are used.
+ */
+#ifndef BI_WORD_BITS
+#if defined(__SIZEOF_INT128__)
+#define BI_WORD_BITS 64
+#else
+#define BI_WORD_BITS 32
+#endif
+#endif
+
+#if BI_WORD_BITS == 64
+typedef uint64_t bi_word;
+__extension__ typedef unsigned __int128 bi_dword;
+#elif BI_WORD_BITS == 32
+typedef uint32_t bi_word;
+typedef uint64_t bi_dword;
+#else
+#error "BI_WORD_BITS must be 32 or 64"
+#endif
+
+/* Words stored inside the BigInt structure before the digits move to the heap */
+#ifndef BI_INLINE_WORDS
+#define BI_INLINE_WORDS 4
+#endif
+
+/*
+ * Raw format written by bi_to_raw(): a 16 byte header of the magic "BIGN",
+ * the limb size (8), the sign (0, 1 or 0xFF for -1), two zero bytes and the
+ * number of limbs as a little-endian 64-bit integer, followed by the
+ * magnitude in little-endian 64-bit limbs, least significant first. The
+ * limbs are 8 byte aligned relative to the start of the record. The zero
+ * bytes are reserved for later versions, readers reject records where they
+ * are not zero.
+ */
+#define BI_RAW_MAGIC "BIGN"
+#define BI_RAW_HEADER_SIZE 16
+#define BI_RAW_LIMB_SIZE 8
 
 /**
  * @struct BigInt
  * @brief Structure representing a large integer using signed-magnitude representation.
  * @var BigInt::sign Sign of the number (1 for positive, -1 for negative, 0 for zero).
- * @var BigInt::length Number of active 32-bit words in the digits array.
+ * @var BigInt::length Number of active words in the digits array.
  * @var BigInt::capacity Total allocated size of the digits array in words.
- * @var BigInt::digits Pointer to the dynamically allocated array of 32-bit words.
+ * @var BigInt::digits Pointer to the array of BI_WORD_BITS wide words, inline_digits or a heap block.
+ * @var BigInt::inline_digits Storage used while the value fits, so small values need no digit array.
+ * * Since digits may point into the structure itself, a BigInt must not be
+ * copied by assignment; use bi_set() or bi_copy() instead.
  */
 typedef struct
 {
     int sign;
     size_t length;
     size_t capacity;
-    uint32_t* digits;
+    bi_word* digits;
+    bi_word inline_digits[BI_INLINE_WORDS];
 } BigInt;
 
+/**
+ * @brief Opaque allocation pool recycling BigInt structures and digit arrays.
+ */
+typedef struct BiPool BiPool;
+
+/**
+ * @brief Creates an empty allocation pool.
+ * @return Pointer to the new pool, or NULL if allocation fails.
+ */
+BiPool* bi_pool_create(void);
+
+/**
+ * @brief Makes the pool serve all following BigInt allocations and releases of the calling thread.
+ * Values allocated under a pool remain valid after it is deactivated or destroyed.
+ * @param pool Pool to activate, or NULL to use the plain allocator.
+ * @return The previously active pool, to be restored by the caller.
+ */
+BiPool* bi_pool_activate(BiPool* pool);
+
+/**
+ * @brief Returns all memory cached by the pool to the system.
+ * @param pool Pointer to the pool.
+ */
+void bi_pool_trim(BiPool* pool);
+
+/**
+ * @brief Frees the pool and its cached memory, deactivating it if it is active.
+ * @param pool Pointer to the pool to be destroyed.
+ */
+void bi_pool_destroy(BiPool* pool);
+
 /**
  * @brief Allocates and initializes a new BigInt with value zero.
  * @return Pointer to the new BigInt, or NULL if allocation fails.
@@ -42,6 +117,20 @@ BigInt* bi_create();
  */
 void bi_destroy(BigInt* num);
 
+/**
+ * @brief Initializes a BigInt in storage owned by the caller, e.g. on the stack, to zero.
+ * * Never allocates; the value uses its inline digits until it grows.
+ * Every function taking a BigInt accepts it, except bi_destroy().
+ * @param num Pointer to the structure to initialize.
+ */
+void bi_init(BigInt* num);
+
+/**
+ * @brief Releases the digit array of a BigInt initialized by bi_init(), leaving it zero.
+ * @param num Pointer to the BigInt to be cleared.
+ */
+void bi_clear(BigInt* num);
+
 /**
  * @brief Creates a deep copy of an existing BigInt.
  * @param original Pointer to the source BigInt.
@@ -49,6 +138,29 @@ void bi_destroy(BigInt* num);
  */
 BigInt* bi_copy(const BigInt* original);
 
+/**
+ * @brief Releases the tables the library keeps between calls (cached powers of ten).
+ * They are rebuilt on demand. Conversions use the tables without holding a
+ * lock, so no other thread (pool workers included) may be converting a
+ * number while this runs; call it at shutdown or between jobs.
+ */
+void bi_free_caches(void);
+
+/**
+ * @brief Returns the memory allocated for BigInt values by the calling thread so far.
+ * Digit arrays and structures reused from a pool count as well; scratch
+ * buffers of the algorithms do not.
+ * @return Total number of bytes, differences of two calls measure an operation.
+ */
+size_t bi_allocated_bytes(void);
+
+/**
+ * @brief Sets the operand size from which multiplication, factorial and decimal
+ * conversion split their work over the running thread pool (see threadpool.h).
+ * @param words Size in words, smaller operands are always processed by the calling thread.
+ */
+void bi_set_parallel_threshold(size_t words);
+
 /**
  * @brief Compares absolute values of two BigInts.
  * @param a First operand.
@@ -76,6 +188,22 @@ BigInt* bi_negate(const BigInt* a);
  */
 void bi_shift_left_one(BigInt* n);
 
+/**
+ * @brief Shifts the absolute value left: a * 2^bits. The sign is kept.
+ * @param a Operand.
+ * @param bits Number of bit positions.
+ * @return New BigInt, or NULL on allocation failure.
+ */
+BigInt* bi_shift_left(const BigInt* a, size_t bits);
+
+/**
+ * @brief Shifts the absolute value right, rounding toward zero. The sign is kept.
+ * @param a Operand.
+ * @param bits Number of bit positions.
+ * @return New BigInt, or NULL on allocation failure.
+ */
+BigInt* bi_shift_right(const BigInt* a, size_t bits);
+
 /**
  * @brief Retrieves the value of a specific bit.
  * @param n Pointer to the BigInt.
@@ -109,21 +237,32 @@ BigInt* bi_sub_abs(const BigInt* a, const BigInt* b);
 
 /**
  * @brief Core division algorithm providing both quotient and remainder for absolute values.
+ * Uses a single word divisor loop, Knuth's Algorithm D or Burnikel-Ziegler recursion by size.
  * @param a Dividend.
  * @param b Divisor.
- * @param quotient Pointer where the result quotient will be stored.
- * @param remainder Pointer where the result remainder will be stored.
+ * @param quotient Pointer where the result quotient will be stored, NULL if it is not needed.
+ * @param remainder Pointer where the result remainder will be stored, NULL if it is not needed.
  */
 void bi_div_mod_abs(const BigInt* a, const BigInt* b, BigInt** quotient, BigInt** remainder);
 
 /**
  * @brief Ensures the internal array has at least the required capacity.
+ * * The array grows by at least half of its capacity, so values growing a
+ * word at a time are reallocated only a logarithmic number of times.
  * @param num BigInt to check/resize.
  * @param required_capacity Minimum required number of words.
  * @return true if successful, false on allocation failure.
  */
 bool bi_resize(BigInt* num, size_t required_capacity);
 
+/**
+ * @brief Releases the capacity beyond the length of a BigInt, e.g. before it is kept for long.
+ * * Values that fit move back to the inline digits. A failed reallocation
+ * keeps the larger array, the value is never lost.
+ * @param num BigInt to shrink.
+ */
+void bi_shrink_to_fit(BigInt* num);
+
 /**
  * @brief Full signed addition: a + b.
  * @param a First operand.
@@ -141,13 +280,20 @@ BigInt* bi_add(const BigInt* a, const BigInt* b);
 BigInt* bi_sub(const BigInt* a, const BigInt* b);
 
 /**
- * @brief Full signed multiplication: a * b.
+ * @brief Full signed multiplication: a * b. Uses schoolbook, Karatsuba, Toom-3 or NTT based on operand size.
  * @param a First operand.
  * @param b Second operand.
  * @return Result BigInt.
  */
 BigInt* bi_mul(const BigInt* a, const BigInt* b);
 
+/**
+ * @brief Squaring: a * a. Faster than bi_mul() as every cross product is computed once.
+ * @param a Operand.
+ * @return Result BigInt.
+ */
+BigInt* bi_sqr(const BigInt* a);
+
 /**
  * @brief Full signed division: a / b.
  * @param a First operand.
@@ -166,12 +312,39 @@ BigInt* bi_mod(const BigInt* a, const BigInt* b);
 
 /**
  * @brief Exponentiation: base ^ exponent.
+ * An exponent of 0 gives 1 (0 ^ 0 included) and a negative exponent gives 0,
+ * for every base. Bases 0, 1 and -1 take exponents of any size, other powers
+ * of two become one shift, and the remaining bases use a sliding window over
+ * the exponent bits; those are only limited by the memory for the result.
  * @param base Base number.
- * @param exponent Unsigned 32-bit exponent.
- * @return Result BigInt.
+ * @param exponent Exponent of any size and sign, it is not modified.
+ * @return Result BigInt, or NULL if allocation fails or the result is too large to store.
  */
 BigInt* bi_pow(const BigInt* base, BigInt* exponent);
 
+/**
+ * @brief Modular exponentiation: base ^ exponent % modulus, without building the power.
+ * Montgomery multiplication is used for odd moduli, Barrett reduction otherwise,
+ * so intermediates stay within twice the size of the modulus. The result equals
+ * bi_mod(bi_pow(base, exponent), modulus), including its sign.
+ * @param base Base number.
+ * @param exponent Exponent of any size, negative exponents give 0 like in bi_pow().
+ * @param modulus Modulus, must not be zero.
+ * @return Result BigInt, or NULL if the modulus is zero or allocation fails.
+ */
+BigInt* bi_powmod(const BigInt* base, const BigInt* exponent, const BigInt* modulus);
+
+/**
+ * @brief Modular multiplication: a * b % modulus.
+ * Operands longer than the modulus are reduced before the product is formed.
+ * The result equals bi_mod(bi_mul(a, b), modulus), including its sign.
+ * @param a First factor.
+ * @param b Second factor.
+ * @param modulus Modulus, must not be zero.
+ * @return Result BigInt, or NULL if the modulus is zero or allocation fails.
+ */
+BigInt* bi_mulmod(const BigInt* a, const BigInt* b, const BigInt* modulus);
+
 /**
  * @brief Calculates factorial of n.
  * @param n Input value.
@@ -179,6 +352,132 @@ BigInt* bi_pow(const BigInt* base, BigInt* exponent);
  */
 BigInt* bi_fact(uint32_t n);
 
+/* DESTINATION PASSING FUNCTIONS
+ * The result is stored in dst, which must be an existing BigInt and may be the
+ * same object as any of the operands. On failure false is returned and dst is
+ * left in a valid but unspecified state.
+ */
+
+/**
+ * @brief Copies the value of src into dst, reusing the storage of dst.
+ * @param dst Destination.
+ * @param src Source, NULL sets dst to zero.
+ * @return true on success.
+ */
+bool bi_set(BigInt* dst, const BigInt* src);
+
+/**
+ * @brief Addition into a destination: dst = a + b.
+ * @param dst Destination.
+ * @param a First operand.
+ * @param b Second operand.
+ * @return true on success.
+ */
+bool bi_add_to(BigInt* dst, const BigInt* a, const BigInt* b);
+
+/**
+ * @brief Subtraction into a destination: dst = a - b.
+ * @param dst Destination.
+ * @param a Minuend.
+ * @param b Subtrahend.
+ * @return true on success.
+ */
+bool bi_sub_to(BigInt* dst, const BigInt* a, const BigInt* b);
+
+/**
+ * @brief Multiplication into a destination: dst = a * b.
+ * @param dst Destination.
+ * @param a First factor.
+ * @param b Second factor.
+ * @return true on success.
+ */
+bool bi_mul_to(BigInt* dst, const BigInt* a, const BigInt* b);
+
+/**
+ * @brief Squaring into a destination: dst = a * a.
+ * @param dst Destination.
+ * @param a Operand.
+ * @return true on success.
+ */
+bool bi_sqr_to(BigInt* dst, const BigInt* a);
+
+/**
+ * @brief Integer division into a destination: dst = a / b.
+ * @param dst Destination.
+ * @param a Dividend.
+ * @param b Divisor.
+ * @return true on success, false also on division by zero.
+ */
+bool bi_div_to(BigInt* dst, const BigInt* a, const BigInt* b);
+
+/**
+ * @brief Modulo into a destination: dst = a % b, sign follows the dividend.
+ * @param dst Destination.
+ * @param a Dividend.
+ * @param b Divisor.
+ * @return true on success, false also on division by zero.
+ */
+bool bi_mod_to(BigInt* dst, const BigInt* a, const BigInt* b);
+
+/**
+ * @brief Exponentiation into a destination: dst = base ^ exponent.
+ * @param dst Destination.
+ * @param base Base number.
+ * @param exponent Exponent.
+ * @return true on success.
+ */
+bool bi_pow_to(BigInt* dst, const BigInt* base, BigInt* exponent);
+
+/**
+ * @brief Modular exponentiation into a destination: dst = base ^ exponent % modulus.
+ * @param dst Destination.
+ * @param base Base number.
+ * @param exponent Exponent.
+ * @param modulus Modulus, must not be zero.
+ * @return true on success, false also on a zero modulus.
+ */
+bool bi_powmod_to(BigInt* dst, const BigInt* base, const BigInt* exponent, const BigInt* modulus);
+
+/**
+ * @brief Modular multiplication into a destination: dst = a * b % modulus.
+ * @param dst Destination.
+ * @param a First factor.
+ * @param b Second factor.
+ * @param modulus Modulus, must not be zero.
+ * @return true on success, false also on a zero modulus.
+ */
+bool bi_mulmod_to(BigInt* dst, const BigInt* a, const BigInt* b, const BigInt* modulus);
+
+/**
+ * @brief Negation into a destination: dst = -a.
+ * @param dst Destination.
+ * @param a Operand.
+ * @return true on success.
+ */
+bool bi_negate_to(BigInt* dst, const BigInt* a);
+
+/**
+ * @brief Element-wise addition of arrays: dst[i] = a[i] + b[i].
+ * * Without an active pool, the items share a temporary one, so memory
+ * freed by one item is reused by the next.
+ * @param dst Destinations, each may alias its operands.
+ * @param a First operands.
+ * @param b Second operands.
+ * @param count Number of items.
+ * @return true if every item succeeded; a failed item keeps its previous value.
+ */
+bool bi_add_batch(BigInt* const* dst, const BigInt* const* a, const BigInt* const* b, size_t count);
+
+/**
+ * @brief Element-wise multiplication of arrays: dst[i] = a[i] * b[i], like bi_add_batch().
+ * @param dst Destinations, each may alias its operands.
+ * @param a First factors.
+ * @param b Second factors.
+ * @param count Number of items.
+ * @return true if every item succeeded.
+ */
+bool bi_mul_batch(BigInt* const* dst, const BigInt* const* a, const BigInt* const* b, size_t count);
+
 /**
  * @brief Generic string to BigInt converter (handles 0x, 0b, and dec).
  * @param str Input string.
@@ -193,6 +492,14 @@ BigInt* bi_from_str(const char* str);
  */
 BigInt* bi_from_hex(const char* str);
 
+/**
+ * @brief Converts hexadecimal chars given by pointer and length to BigInt.
+ * @param str First hex digit (without 0x), need not be terminated.
+ * @param n Number of chars.
+ * @return New BigInt, or NULL if a char is not a hex digit.
+ */
+BigInt* bi_from_hex_n(const char* str, size_t n);
+
 /**
  * @brief Converts decimal string to BigInt.
  * @param str Decimal string.
@@ -200,6 +507,14 @@ BigInt* bi_from_hex(const char* str);
  */
 BigInt* bi_from_dec(const char* str);
 
+/**
+ * @brief Converts decimal chars given by pointer and length to BigInt.
+ * @param str First decimal digit, need not be terminated.
+ * @param n Number of chars.
+ * @return New BigInt.
+ */
+BigInt* bi_from_dec_n(const char* str, size_t n);
+
 /**
  * @brief Converts binary string to BigInt. Handles Two's Complement for fixed lengths.
  * @param str Binary string (without 0b).
@@ -207,6 +522,14 @@ BigInt* bi_from_dec(const char* str);
  */
 BigInt* bi_from_bin(const char* str);
 
+/**
+ * @brief Converts binary chars given by pointer and length to BigInt, as Two's Complement.
+ * @param str First binary digit (without 0b), need not be terminated.
+ * @param n Number of chars.
+ * @return New BigInt, or NULL if a char is not 0 or 1.
+ */
+BigInt* bi_from_bin_n(const char* str, size_t n);
+
 /**
  * @brief Converts BigInt to hexadecimal string.
  * @param n BigInt to convert.
@@ -221,6 +544,32 @@ char* bi_to_hex(const BigInt* n);
  */
 char* bi_to_dec(const BigInt* n);
 
+/**
+ * @brief Summarizes n by its leading and trailing decimal digits and the digit count.
+ * * Numbers of at most 2 * edge digits are written in full, e.g. "-1234 (4 digits)".
+ * Longer ones give e.g. "12345...67890 (1000 digits)" without being converted
+ * in full: one quotient-only and one remainder-only division by powers of ten.
+ * @param n BigInt to summarize.
+ * @param edge Number of leading and of trailing digits shown.
+ * @return Dynamically allocated string. MUST be freed by caller!
+ */
+char* bi_to_dec_summary(const BigInt* n, size_t edge);
+
+/**
+ * @brief Upper bound of the length of the decimal text of n, sign included.
+ * @param n BigInt to measure.
+ * @return Number of characters without the terminator.
+ */
+size_t bi_dec_size(const BigInt* n);
+
+/**
+ * @brief Writes the decimal text of n with a terminator into a buffer of the caller.
+ * @param n BigInt to convert.
+ * @param out Buffer of at least bi_dec_size(n) + 1 characters.
+ * @return Length of the text, 0 on allocation failure.
+ */
+size_t bi_format_dec(const BigInt* n, char* out);
+
 /**
  * @brief Converts BigInt to binary string.
  * @param n BigInt to convert.
@@ -228,4 +577,66 @@ char* bi_to_dec(const BigInt* n);
  */
 char* bi_to_bin(const BigInt* n);
 
+/**
+ * @brief Writes n in decimal to a stream, converting huge numbers piece by piece.
+ * @param n BigInt to write.
+ * @param f Output stream.
+ * @return true on success, false on allocation or write failure.
+ */
+bool bi_write_dec(const BigInt* n, FILE* f);
+
+/**
+ * @brief Writes n to a stream as bi_to_hex() formats it, in blocks.
+ * @param n BigInt to write.
+ * @param f Output stream.
+ * @return true on success, false on allocation or write failure.
+ */
+bool bi_write_hex(const BigInt* n, FILE* f);
+
+/**
+ * @brief Writes n to a stream as bi_to_bin() formats it, in blocks.
+ * @param n BigInt to write.
+ * @param f Output stream.
+ * @return true on success, false on allocation or write failure.
+ */
+bool bi_write_bin(const BigInt* n, FILE* f);
+
+/**
+ * @brief Returns the size of the raw format record of n.
+ * @param n BigInt to measure.
+ * @return Size in bytes, header included.
+ */
+size_t bi_raw_size(const BigInt* n);
+
+/**
+ * @brief Serializes n into the raw format without any base conversion.
+ * @param n BigInt to serialize.
+ * @param size Receives the size of the record, may be NULL.
+ * @return Dynamically allocated record. MUST be freed by caller!
+ */
+unsigned char* bi_to_raw(const BigInt* n, size_t* size);
+
+/**
+ * @brief Reads a raw format record, e.g. from a memory mapped file.
+ * @param data Start of the record.
+ * @param size Bytes available from data.
+ * @return New BigInt, or NULL if the record is invalid or truncated.
+ */
+BigInt* bi_from_raw(const void* data, size_t size);
+
+/**
+ * @brief Writes the raw format record of n to a stream.
+ * @param n BigInt to write.
+ * @param f Binary output stream.
+ * @return true on success, false on allocation or write failure.
+ */
+bool bi_write_raw(const BigInt* n, FILE* f);
+
+/**
+ * @brief Reads one raw format record from a stream.
+ * @param f Binary input stream.
+ * @return New BigInt, or NULL if the record is invalid or truncated.
+ */
+BigInt* bi_read_raw(FILE* f);
+
 #endif // BIGINT_H
@@ -0,0 +1,81 @@
+/**
+ * @file bigint_tuning.h
+ * @brief Algorithm thresholds of bigint.c, internal to the library.
+ * * Every value may be overridden with -D when building; the fuzz harness
+ * includes this header too, so it probes the crossover points the library
+ * was actually built with.
+ */
+
+#ifndef BIGINT_TUNING_H
+#define BIGINT_TUNING_H
+
+#include "bigint.h"
+
+/* Operand sizes in words from which the faster multiplication tiers are used */
+#ifndef KARATSUBA_THRESHOLD
+#define KARATSUBA_THRESHOLD 32
+#endif
+#ifndef KARATSUBA_SQR_THRESHOLD
+#define KARATSUBA_SQR_THRESHOLD 48
+#endif
+#ifndef TOOM3_THRESHOLD
+#define TOOM3_THRESHOLD 160
+#endif
+#ifndef TOOM3_SQR_THRESHOLD
+#define TOOM3_SQR_THRESHOLD 200
+#endif
+/* 64-bit words feed two 32-bit chunks each into the transform but make Toom-3 cheaper per bit */
+#if BI_WORD_BITS == 64
+#ifndef NTT_THRESHOLD
+#define NTT_THRESHOLD 12000
+#endif
+#ifndef NTT_SQR_THRESHOLD
+#define NTT_SQR_THRESHOLD 13000
+#endif
+#else
+#ifndef NTT_THRESHOLD
+#define NTT_THRESHOLD 3000
+#endif
+#ifndef NTT_SQR_THRESHOLD
+#define NTT_SQR_THRESHOLD 3500
+#endif
+#endif
+
+/* Divisor size in words from which Burnikel-Ziegler division is used */
+#ifndef BZ_THRESHOLD
+#define BZ_THRESHOLD 80
+#endif
+#ifndef BZ_OFFSET
+#define BZ_OFFSET 40        /* Minimal excess of dividend words over divisor words */
+#endif
+
+/* Modulus size in words from which Barrett reduction replaces Montgomery's for odd moduli */
+#ifndef MONTGOMERY_MAX_WORDS
+#define MONTGOMERY_MAX_WORDS 600
+#endif
+
+/* Number of factors multiplied one by one at the leaves of the factorial product tree */
+#ifndef FACT_LEAF_FACTORS
+#define FACT_LEAF_FACTORS 16
+#endif
+
+/* Size in words from which decimal conversion splits the number recursively */
+#ifndef DEC_DC_THRESHOLD
+#define DEC_DC_THRESHOLD 40
+#endif
+
+/* Decimal digits from which streamed output is converted piece by piece */
+#ifndef DEC_STREAM_DIGITS
+#define DEC_STREAM_DIGITS 262144
+#endif
+
+/* Operand size in words from which independent sub-results are computed in parallel */
+#ifndef PARALLEL_THRESHOLD
+#define PARALLEL_THRESHOLD 2000
+#endif
+
+#if KARATSUBA_THRESHOLD < 4 || KARATSUBA_SQR_THRESHOLD < 4
+#error "Karatsuba needs operands of at least 4 words"
+#endif
+
+#endif /* BIGINT_TUNING_H */
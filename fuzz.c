@@ -0,0 +1,960 @@
+/**
+ * @file fuzz.c
+ * @brief Differential check of the evaluator and the kernels against GMP.
+ * * Sizes are every power of ten from 1 word up to the largest size, plus the
+ * sizes just below, at and just above each algorithm threshold of bigint.c.
+ * At each size the kernels are checked and timed next to their GMP
+ * counterparts. Then random expressions are evaluated by eval_expression()
+ * and compared with the same expression computed by GMP. Results are printed
+ * as CSV, failed checks are reported on stderr and fail the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <gmp.h>
+#include "bigint.h"
+#include "bigint_tuning.h"
+#include "parser.h"
+#include "memo.h"
+#include "threadpool.h"
+#include "util.h"
+
+#define BASE_DEC 10
+#define BASE_HEX 16
+#define BASE_BIN 2
+#define DEFAULT_MAX_WORDS 1000000   /* Largest operand size in words */
+#define DEFAULT_MIN_TIME_MS 200     /* Minimum time spent on one case at one size */
+#define DEFAULT_MAX_EXPRESSIONS 1000 /* Upper bound of random expressions per size */
+#define MAX_SIZES 128
+#define MAX_RESULTS 1024
+#define MAX_BIN_LITERAL_WORDS 1000  /* Larger literals are written in decimal or hex */
+#define MAX_NESTED_WORDS 1000       /* Larger expressions have a single operator */
+#define MAX_POWMOD_WORDS 1000       /* Largest modulus of the modular operators */
+#define MAX_EXPONENT_WORDS 16       /* Largest exponent of the modular power */
+#define MAX_SHOWN_EXPRESSION 200    /* Characters of a failed expression shown on stderr */
+#define INITIAL_EXPRESSION_SIZE 256
+#define OPT_MAX_WORDS "--max-words="
+#define OPT_MIN_TIME "--min-time="
+#define OPT_MAX_EXPRESSIONS "--expressions="
+#define OPT_SEED "--seed="
+#define OPT_CASES "--cases="
+#define OPT_THREADS "--threads="
+
+/* Operand shapes, the regular ones hit the carry and normalization edge cases */
+typedef enum
+{
+    SHAPE_RANDOM,
+    SHAPE_ONES,         /* Every bit set */
+    SHAPE_POWER,        /* Only the top bit set */
+    SHAPE_SPARSE,       /* Mostly zero words */
+    SHAPE_SMALL_TOP,    /* Top word 1 */
+    SHAPES
+} OperandShape;
+
+/* Operands of one case in both representations, prepared outside of the timed part */
+typedef struct
+{
+    BigInt* a;
+    BigInt* b;
+    char* text;
+    mpz_t za;
+    mpz_t zb;
+    mpz_t zq;
+    mpz_t zr;
+} FuzzInput;
+
+typedef struct
+{
+    const char* name;
+    bool (*prepare)(FuzzInput* input, size_t words);
+    bool (*check)(FuzzInput* input);       /* Compares one result with GMP's */
+    bool (*run)(FuzzInput* input);
+    bool (*run_gmp)(FuzzInput* input);
+} FuzzKernel;
+
+/* Timed call of a kernel on prepared operands */
+typedef struct
+{
+    bool (*run)(FuzzInput* input);
+    FuzzInput* input;
+} FuzzCall;
+
+typedef struct
+{
+    const char* name;
+    size_t words;
+    unsigned long checks;
+    unsigned long failures;
+    double ns_per_op;
+    double gmp_ns_per_op;    /* 0 if GMP has no counterpart */
+} FuzzResult;
+
+/* Text of a random expression, its value is computed by GMP alongside */
+typedef struct
+{
+    char* text;
+    size_t length;
+    size_t capacity;
+    bool ok;
+    bool division_by_zero;
+} ExprBuilder;
+
+static unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+
+/* HELP FUNCTIONS */
+
+/* A run is repeated exactly by giving its seed */
+static unsigned long long random_next(void)
+{
+    return util_random_next(&random_state);
+}
+
+static size_t random_below(size_t n)
+{
+    return (size_t)(random_next() % n);
+}
+
+/* Fills a nonzero magnitude of exactly the given number of words */
+static void random_words(bi_word* digits, size_t words)
+{
+    OperandShape shape = (OperandShape)random_below(2 * SHAPES);
+    size_t i;
+
+    /* Half of the operands are plain random */
+    if (shape >= SHAPES) shape = SHAPE_RANDOM;
+    for (i = 0; i < words; i++)
+    {
+        switch (shape)
+        {
+        case SHAPE_ONES: digits[i] = ~(bi_word)0; break;
+        case SHAPE_POWER: digits[i] = 0; break;
+        case SHAPE_SPARSE: digits[i] = random_below(8) == 0 ? (bi_word)random_next() : 0; break;
+        default: digits[i] = (bi_word)random_next(); break;
+        }
+    }
+    if (shape == SHAPE_POWER) digits[words - 1] = (bi_word)1 << (BI_WORD_BITS - 1);
+    else if (shape == SHAPE_SMALL_TOP) digits[words - 1] = 1;
+    else if (digits[words - 1] == 0) digits[words - 1] = (bi_word)random_next() | 1;
+}
+
+/* Sets z to a random positive number of exactly the given number of words */
+static bool random_mpz(mpz_t z, size_t words)
+{
+    bi_word* digits = (bi_word*)malloc(words * sizeof(bi_word));
+
+    if (!digits) return false;
+    random_words(digits, words);
+    mpz_import(z, words, -1, sizeof(bi_word), 0, 0, digits);
+    free(digits);
+    return true;
+}
+
+/* Creates the same random positive number as a BigInt and in z */
+static BigInt* random_number(mpz_t z, size_t words)
+{
+    BigInt* n = bi_create();
+
+    if (!n || !bi_resize(n, words))
+    {
+        bi_destroy(n);
+        return NULL;
+    }
+    random_words(n->digits, words);
+    n->length = words;
+    n->sign = 1;
+    mpz_import(z, words, -1, sizeof(bi_word), 0, 0, n->digits);
+    return n;
+}
+
+/* Compares a BigInt with a GMP value, a zero must also have sign 0 */
+static bool same_value(const BigInt* n, const mpz_t z)
+{
+    mpz_t value;
+    bool same;
+
+    if (!n) return false;
+    mpz_init(value);
+    mpz_import(value, n->length, -1, sizeof(bi_word), 0, 0, n->digits);
+    if (n->sign == -1) mpz_neg(value, value);
+    same = mpz_cmp(value, z) == 0 && (n->sign == 0) == (mpz_sgn(z) == 0);
+    mpz_clear(value);
+    return same;
+}
+
+/* Decimal text of z in a buffer allocated by malloc */
+static char* mpz_dec(const mpz_t z)
+{
+    char* text = (char*)malloc(mpz_sizeinbase(z, BASE_DEC) + 2);
+
+    if (text) mpz_get_str(text, BASE_DEC, z);
+    return text;
+}
+
+/* Smallest m whose factorial has about the given number of bits */
+static unsigned long fact_argument(double bits)
+{
+    unsigned long low = 1, high = 2, middle;
+
+    while (lgamma((double)high + 1.0) / log(2.0) < bits) high *= 2;
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (lgamma((double)middle + 1.0) / log(2.0) < bits) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+static void init_input(FuzzInput* input)
+{
+    input->a = NULL;
+    input->b = NULL;
+    input->text = NULL;
+    mpz_inits(input->za, input->zb, input->zq, input->zr, NULL);
+}
+
+static void release_input(FuzzInput* input)
+{
+    bi_destroy(input->a);
+    bi_destroy(input->b);
+    free(input->text);
+    mpz_clears(input->za, input->zb, input->zq, input->zr, NULL);
+}
+
+/* KERNELS */
+
+static bool prepare_mul(FuzzInput* input, size_t words)
+{
+    input->a = random_number(input->za, words);
+    input->b = random_number(input->zb, words);
+    return input->a && input->b;
+}
+
+static bool check_mul(FuzzInput* input)
+{
+    BigInt* r = bi_mul(input->a, input->b);
+    bool same;
+
+    mpz_mul(input->zr, input->za, input->zb);
+    same = same_value(r, input->zr);
+    bi_destroy(r);
+    return same;
+}
+
+static bool run_mul(FuzzInput* input)
+{
+    BigInt* r = bi_mul(input->a, input->b);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+static bool run_gmp_mul(FuzzInput* input)
+{
+    mpz_mul(input->zr, input->za, input->zb);
+    return true;
+}
+
+static bool prepare_sqr(FuzzInput* input, size_t words)
+{
+    input->a = random_number(input->za, words);
+    return input->a != NULL;
+}
+
+static bool check_sqr(FuzzInput* input)
+{
+    BigInt* r = bi_mul(input->a, input->a);
+    bool same;
+
+    mpz_mul(input->zr, input->za, input->za);
+    same = same_value(r, input->zr);
+    bi_destroy(r);
+    return same;
+}
+
+static bool run_sqr(FuzzInput* input)
+{
+    BigInt* r = bi_mul(input->a, input->a);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+static bool run_gmp_sqr(FuzzInput* input)
+{
+    mpz_mul(input->zr, input->za, input->za);
+    return true;
+}
+
+/* Dividend of up to twice the size of the divisor, around the Burnikel-Ziegler offset */
+static bool prepare_div(FuzzInput* input, size_t words)
+{
+    input->a = random_number(input->za, words + 1 + random_below(words));
+    input->b = random_number(input->zb, words);
+    return input->a && input->b;
+}
+
+static bool check_div(FuzzInput* input)
+{
+    BigInt* q = NULL;
+    BigInt* r = NULL;
+    bool same;
+
+    bi_div_mod_abs(input->a, input->b, &q, &r);
+    mpz_tdiv_qr(input->zq, input->zr, input->za, input->zb);
+    same = same_value(q, input->zq) && same_value(r, input->zr);
+    bi_destroy(q);
+    bi_destroy(r);
+    return same;
+}
+
+static bool run_div(FuzzInput* input)
+{
+    BigInt* q = NULL;
+    BigInt* r = NULL;
+    bool ok;
+
+    bi_div_mod_abs(input->a, input->b, &q, &r);
+    ok = q && r;
+    bi_destroy(q);
+    bi_destroy(r);
+    return ok;
+}
+
+static bool run_gmp_div(FuzzInput* input)
+{
+    mpz_tdiv_qr(input->zq, input->zr, input->za, input->zb);
+    return true;
+}
+
+/* The buffer of the text receives the output of GMP */
+static bool prepare_to_dec(FuzzInput* input, size_t words)
+{
+    input->a = random_number(input->za, words);
+    if (!input->a) return false;
+    input->text = (char*)malloc(mpz_sizeinbase(input->za, BASE_DEC) + 2);
+    return input->text != NULL;
+}
+
+static bool check_to_dec(FuzzInput* input)
+{
+    char* text = bi_to_dec(input->a);
+    bool same;
+
+    mpz_get_str(input->text, BASE_DEC, input->za);
+    same = text && strcmp(text, input->text) == 0;
+    free(text);
+    return same;
+}
+
+static bool run_to_dec(FuzzInput* input)
+{
+    char* text = bi_to_dec(input->a);
+
+    free(text);
+    return text != NULL;
+}
+
+static bool run_gmp_to_dec(FuzzInput* input)
+{
+    mpz_get_str(input->text, BASE_DEC, input->za);
+    return true;
+}
+
+static bool prepare_from_dec(FuzzInput* input, size_t words)
+{
+    if (!random_mpz(input->za, words)) return false;
+    input->text = mpz_dec(input->za);
+    return input->text != NULL;
+}
+
+static bool check_from_dec(FuzzInput* input)
+{
+    BigInt* r = bi_from_dec(input->text);
+    bool same = same_value(r, input->za);
+
+    bi_destroy(r);
+    return same;
+}
+
+static bool run_from_dec(FuzzInput* input)
+{
+    BigInt* r = bi_from_dec(input->text);
+
+    bi_destroy(r);
+    return r != NULL;
+}
+
+static bool run_gmp_from_dec(FuzzInput* input)
+{
+    return mpz_set_str(input->zr, input->text, BASE_DEC) == 0;
+}
+
+static const FuzzKernel kernels[] =
+{
+    { "mul", prepare_mul, check_mul, run_mul, run_gmp_mul },
+    { "sqr", prepare_sqr, check_sqr, run_sqr, run_gmp_sqr },
+    { "div_mod", prepare_div, check_div, run_div, run_gmp_div },
+    { "to_dec", prepare_to_dec, check_to_dec, run_to_dec, run_gmp_to_dec },
+    { "from_dec", prepare_from_dec, check_from_dec, run_from_dec, run_gmp_from_dec }
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+/* EXPRESSIONS */
+
+static bool builder_reserve(ExprBuilder* b, size_t extra)
+{
+    size_t new_capacity;
+    char* new_text;
+
+    if (!b->ok) return false;
+    if (b->length + extra < b->capacity) return true;
+
+    new_capacity = b->capacity;
+    while (b->length + extra >= new_capacity) new_capacity *= 2;
+    new_text = (char*)realloc(b->text, new_capacity);
+    if (!new_text)
+    {
+        b->ok = false;
+        return false;
+    }
+    b->text = new_text;
+    b->capacity = new_capacity;
+    return true;
+}
+
+static void builder_append(ExprBuilder* b, const char* text)
+{
+    size_t length = strlen(text);
+
+    if (!builder_reserve(b, length)) return;
+    memcpy(b->text + b->length, text, length + 1);
+    b->length += length;
+}
+
+/* Writes a nonnegative value in decimal, hex or binary notation */
+static void append_literal(ExprBuilder* b, const mpz_t value)
+{
+    size_t words = mpz_size(value) * sizeof(mp_limb_t) / sizeof(bi_word);
+    size_t choice = random_below(words > MAX_BIN_LITERAL_WORDS ? 2 : 3);
+    int base = choice == 0 ? BASE_DEC : choice == 1 ? BASE_HEX : BASE_BIN;
+
+    /* Hex and binary literals are two's complement, a leading zero keeps them positive */
+    if (base == BASE_HEX) builder_append(b, "0x0");
+    else if (base == BASE_BIN) builder_append(b, "0b0");
+    if (!builder_reserve(b, mpz_sizeinbase(value, base) + 2)) return;
+    mpz_get_str(b->text + b->length, base, value);
+    b->length += strlen(b->text + b->length);
+}
+
+/* Random literal of about the given size, sometimes zero or negated */
+static void gen_operand(ExprBuilder* b, mpz_t value, size_t words)
+{
+    bool negative = random_below(4) == 0;
+
+    if (random_below(16) == 0) mpz_set_ui(value, 0);
+    else if (!random_mpz(value, words + random_below(3) - (words > 1))) b->ok = false;
+
+    if (negative) builder_append(b, "(-");
+    append_literal(b, value);
+    if (negative)
+    {
+        builder_append(b, ")");
+        mpz_neg(value, value);
+    }
+}
+
+/* Truncated remainder like '%', r takes the sign of the dividend; a zero modulus is recorded */
+static void reference_mod(ExprBuilder* b, mpz_t value, const mpz_t modulus)
+{
+    if (mpz_sgn(modulus) == 0) b->division_by_zero = true;
+    else mpz_tdiv_r(value, value, modulus);
+}
+
+/* Appends a random expression whose operands have about the given size */
+static void gen_expr(ExprBuilder* b, mpz_t value, size_t words, int depth)
+{
+    mpz_t right, modulus;
+    char number[32];
+    unsigned long base, exponent;
+    bool negative;
+    size_t op;
+
+    if (depth == 0)
+    {
+        gen_operand(b, value, words);
+        return;
+    }
+
+    mpz_inits(right, modulus, NULL);
+    op = random_below(words <= MAX_POWMOD_WORDS ? 9 : 7);
+    switch (op)
+    {
+    case 0:
+    case 1:
+    case 2:
+        builder_append(b, "(");
+        gen_expr(b, value, words, depth - 1);
+        builder_append(b, op == 0 ? "+" : op == 1 ? "-" : "*");
+        gen_expr(b, right, words, depth - 1);
+        builder_append(b, ")");
+        if (op == 0) mpz_add(value, value, right);
+        else if (op == 1) mpz_sub(value, value, right);
+        else mpz_mul(value, value, right);
+        break;
+
+    case 3:
+    case 4:
+        /* The dividend is up to twice the size of the divisor */
+        builder_append(b, "(");
+        gen_expr(b, value, words + random_below(words + 1), depth - 1);
+        builder_append(b, op == 3 ? "/" : "%");
+        gen_expr(b, right, words, depth - 1);
+        builder_append(b, ")");
+        if (mpz_sgn(right) == 0) b->division_by_zero = true;
+        else if (op == 3) mpz_tdiv_q(value, value, right);
+        else mpz_tdiv_r(value, value, right);
+        break;
+
+    case 5:
+        /* Small base, the exponent makes the power about the given size */
+        base = 2 + (unsigned long)random_below(0xFFFF);
+        exponent = (unsigned long)(words * BI_WORD_BITS / (size_t)(log((double)base) / log(2.0) + 1.0));
+        exponent += (unsigned long)random_below(BI_WORD_BITS);
+        negative = random_below(2) == 0;
+        sprintf(number, "(%s%lu)^%lu", negative ? "-" : "", base, exponent);
+        builder_append(b, number);
+        mpz_ui_pow_ui(value, base, exponent);
+        if (negative && exponent % 2 == 1) mpz_neg(value, value);
+        break;
+
+    case 6:
+        exponent = fact_argument((double)words * BI_WORD_BITS) + (unsigned long)random_below(16);
+        sprintf(number, "(%lu!)", exponent);
+        builder_append(b, number);
+        mpz_fac_ui(value, exponent);
+        break;
+
+    case 7:
+        /* a^e % m, fused by the compiler or written as powmod(a, e, m) */
+        if (!random_mpz(right, words < MAX_EXPONENT_WORDS ? words : MAX_EXPONENT_WORDS)) b->ok = false;
+        if (random_below(2))
+        {
+            builder_append(b, "(");
+            gen_operand(b, value, words);
+            builder_append(b, "^");
+            append_literal(b, right);
+            builder_append(b, "%");
+            gen_operand(b, modulus, words);
+            builder_append(b, ")");
+        }
+        else
+        {
+            builder_append(b, "powmod(");
+            gen_operand(b, value, words);
+            builder_append(b, ",");
+            append_literal(b, right);
+            builder_append(b, ",");
+            gen_operand(b, modulus, words);
+            builder_append(b, ")");
+        }
+        if (mpz_sgn(modulus) == 0)
+        {
+            b->division_by_zero = true;
+        }
+        else
+        {
+            /* GMP gives the least nonnegative residue, '%' takes the sign of the power */
+            negative = mpz_sgn(value) < 0 && mpz_odd_p(right);
+            mpz_abs(value, value);
+            mpz_abs(modulus, modulus);
+            mpz_powm(value, value, right, modulus);
+            if (negative) mpz_neg(value, value);
+        }
+        break;
+
+    default:
+        /* a*b % m, fused into the modular product */
+        builder_append(b, "(");
+        gen_operand(b, value, words);
+        builder_append(b, "*");
+        gen_operand(b, right, words);
+        builder_append(b, "%");
+        gen_operand(b, modulus, words);
+        builder_append(b, ")");
+        mpz_mul(value, value, right);
+        reference_mod(b, value, modulus);
+        break;
+    }
+    mpz_clears(right, modulus, NULL);
+}
+
+/* Reports a failed expression, shortened; the seed and size repeat it */
+static void report_expression(const ExprBuilder* b, size_t words, const char* reason)
+{
+    fprintf(stderr, "Mismatch at %lu words (%s): %.*s%s\n", (unsigned long)words, reason,
+            MAX_SHOWN_EXPRESSION, b->text, b->length > MAX_SHOWN_EXPRESSION ? "..." : "");
+}
+
+/* Evaluates random expressions until the time is spent, only the evaluation is timed */
+static bool fuzz_expressions(size_t words, double min_time_ns, unsigned long max_expressions, FuzzResult* result)
+{
+    ExprBuilder b;
+    mpz_t value;
+    BigInt* r;
+    EvalStatus status;
+    double start, elapsed = 0.0;
+    bool ok = true;
+
+    b.text = (char*)malloc(INITIAL_EXPRESSION_SIZE);
+    b.capacity = INITIAL_EXPRESSION_SIZE;
+    if (!b.text) return false;
+    mpz_init(value);
+
+    result->name = "expr";
+    result->words = words;
+    result->checks = 0;
+    result->failures = 0;
+    result->gmp_ns_per_op = 0.0;
+
+    while (ok && result->checks < max_expressions && (result->checks == 0 || elapsed < min_time_ns))
+    {
+        b.length = 0;
+        b.text[0] = '\0';
+        b.ok = true;
+        b.division_by_zero = false;
+        gen_expr(&b, value, words, words <= MAX_NESTED_WORDS ? 1 + (int)random_below(2) : 1);
+        if (!b.ok)
+        {
+            ok = false;
+            break;
+        }
+
+        start = util_now_ns();
+        r = eval_expression(b.text, &status);
+        elapsed += util_now_ns() - start;
+        result->checks++;
+
+        if (b.division_by_zero)
+        {
+            if (r || status != EVAL_DIVISION_BY_ZERO)
+            {
+                report_expression(&b, words, "division by zero expected");
+                result->failures++;
+            }
+        }
+        else if (!r)
+        {
+            report_expression(&b, words, eval_status_message(status));
+            result->failures++;
+        }
+        else if (!same_value(r, value))
+        {
+            report_expression(&b, words, "wrong value");
+            result->failures++;
+        }
+        bi_destroy(r);
+    }
+
+    mpz_clear(value);
+    free(b.text);
+    result->ns_per_op = result->checks > 0 ? elapsed / (double)result->checks : 0.0;
+    return ok;
+}
+
+/*
+ * Expressions of fixed bugs with their decimal values, NULL for a syntax
+ * error. A minus after ')' was once taken as unary and rejected.
+ */
+static const char* const regressions[][2] =
+{
+    { "(1)-3", "-2" },
+    { "(2)!-1", "1" },
+    { "(2)-(3)", "-1" },
+    { "(3!)-1", "5" },
+    { "(3!)-(3!)", "0" },
+    { "(2)-(-3)", "5" },
+    { "(2)--3", "5" },
+    { "-(2)-3", "-5" },
+    { "(2)*-3", "-6" },
+    { "powmod(2,10,1000)-(24)", "0" },
+    { "(2)-", NULL },
+    { "()-2", NULL }
+};
+
+#define REGRESSION_COUNT (sizeof(regressions) / sizeof(regressions[0]))
+
+/* Checks the fixed expressions once, before the random sizes */
+static void check_regressions(FuzzResult* result)
+{
+    EvalStatus status;
+    BigInt* r;
+    char* text;
+    size_t i;
+    bool same;
+
+    result->name = "regress";
+    result->words = 0;
+    result->checks = 0;
+    result->failures = 0;
+    result->ns_per_op = 0.0;
+    result->gmp_ns_per_op = 0.0;
+
+    for (i = 0; i < REGRESSION_COUNT; i++)
+    {
+        r = eval_expression(regressions[i][0], &status);
+        text = r ? bi_to_dec(r) : NULL;
+        if (regressions[i][1]) same = text && strcmp(text, regressions[i][1]) == 0;
+        else same = !r && status == EVAL_SYNTAX_ERROR;
+        if (!same)
+        {
+            fprintf(stderr, "Regression: %s gives %s\n", regressions[i][0], text ? text : eval_status_message(status));
+            result->failures++;
+        }
+        result->checks++;
+        free(text);
+        bi_destroy(r);
+    }
+}
+
+/* MEASUREMENT */
+
+static bool run_call(void* context)
+{
+    FuzzCall* call = (FuzzCall*)context;
+
+    return call->run(call->input);
+}
+
+/* Time of one call, repeated until the time is spent; a negative value on failure */
+static double measure(bool (*run)(FuzzInput* input), FuzzInput* input, double min_time_ns)
+{
+    FuzzCall call;
+
+    call.run = run;
+    call.input = input;
+    return util_measure(run_call, &call, min_time_ns, NULL);
+}
+
+/* Checks a kernel on fresh operands until half of the time is spent, then times both libraries */
+static bool fuzz_kernel(const FuzzKernel* kernel, size_t words, double min_time_ns, FuzzResult* result)
+{
+    FuzzInput input;
+    double start = util_now_ns();
+    bool ok, last;
+
+    result->name = kernel->name;
+    result->words = words;
+    result->checks = 0;
+    result->failures = 0;
+
+    for (;;)
+    {
+        init_input(&input);
+        ok = kernel->prepare(&input, words);
+        if (ok)
+        {
+            if (!kernel->check(&input))
+            {
+                fprintf(stderr, "Mismatch: %s at %lu words\n", kernel->name, (unsigned long)words);
+                result->failures++;
+            }
+            result->checks++;
+        }
+
+        /* The last operands are timed */
+        last = util_now_ns() - start >= min_time_ns / 2;
+        if (ok && last)
+        {
+            result->ns_per_op = measure(kernel->run, &input, min_time_ns / 4);
+            result->gmp_ns_per_op = measure(kernel->run_gmp, &input, min_time_ns / 4);
+            ok = result->ns_per_op >= 0.0 && result->gmp_ns_per_op >= 0.0;
+        }
+        release_input(&input);
+        if (!ok || last) return ok;
+    }
+}
+
+static int compare_sizes(const void* a, const void* b)
+{
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Powers of ten and the neighbourhood of every threshold, sorted without duplicates */
+static size_t collect_sizes(size_t* sizes, size_t max_words)
+{
+    static const size_t thresholds[] =
+    {
+        BI_INLINE_WORDS, KARATSUBA_THRESHOLD, KARATSUBA_SQR_THRESHOLD, TOOM3_THRESHOLD,
+        TOOM3_SQR_THRESHOLD, NTT_THRESHOLD, NTT_SQR_THRESHOLD, BZ_THRESHOLD, BZ_THRESHOLD + BZ_OFFSET,
+        MONTGOMERY_MAX_WORDS, DEC_DC_THRESHOLD, PARALLEL_THRESHOLD
+    };
+    size_t count = 0, unique = 0, words, i;
+
+    for (words = 1; words <= max_words && count < MAX_SIZES; words *= 10)
+    {
+        sizes[count++] = words;
+        if (words > (size_t)-1 / 10) break;
+    }
+    for (i = 0; i < sizeof(thresholds) / sizeof(thresholds[0]) && count + 3 <= MAX_SIZES; i++)
+    {
+        for (words = thresholds[i] - 1; words <= thresholds[i] + 1; words++)
+        {
+            if (words >= 1 && words <= max_words) sizes[count++] = words;
+        }
+    }
+
+    qsort(sizes, count, sizeof(size_t), compare_sizes);
+    for (i = 0; i < count; i++)
+    {
+        if (unique == 0 || sizes[unique - 1] != sizes[i]) sizes[unique++] = sizes[i];
+    }
+    return unique;
+}
+
+/* OUTPUT */
+
+static void print_csv(const FuzzResult* results, size_t count)
+{
+    size_t i;
+
+    printf("case,words,checks,failures,ns_per_op,gmp_ns_per_op,ratio\n");
+    for (i = 0; i < count; i++)
+    {
+        printf("%s,%lu,%lu,%lu,%.1f", results[i].name, (unsigned long)results[i].words,
+               results[i].checks, results[i].failures, results[i].ns_per_op);
+        if (results[i].gmp_ns_per_op > 0.0)
+        {
+            printf(",%.1f,%.3f\n", results[i].gmp_ns_per_op, results[i].ns_per_op / results[i].gmp_ns_per_op);
+        }
+        else
+        {
+            printf(",,\n");
+        }
+    }
+}
+
+static void print_usage(void)
+{
+    printf("Usage: fuzz.exe [options]\n"
+           "  --max-words=N     largest operand size in words (default %d)\n"
+           "  --min-time=MS     minimum time of one case at one size (default %d)\n"
+           "  --expressions=N   most random expressions at one size (default %d)\n"
+           "  --seed=N          seed of the operands and expressions (default fixed)\n"
+           "  --cases=LIST      comma separated subset of regress,mul,sqr,div_mod,to_dec,from_dec,expr\n"
+           "  --threads=N       threads for the parallel kernels (default 1)\n",
+           DEFAULT_MAX_WORDS, DEFAULT_MIN_TIME_MS, DEFAULT_MAX_EXPRESSIONS);
+}
+
+int main(int argc, char* argv[])
+{
+    static FuzzResult results[MAX_RESULTS];
+    static size_t sizes[MAX_SIZES];
+    unsigned long max_words = DEFAULT_MAX_WORDS;
+    unsigned long min_time_ms = DEFAULT_MIN_TIME_MS;
+    unsigned long max_expressions = DEFAULT_MAX_EXPRESSIONS;
+    unsigned long threads = 1;
+    unsigned long value;
+    const char* case_list = NULL;
+    size_t result_count = 0;
+    size_t failures = 0;
+    size_t size_count, s, k;
+    double min_time_ns;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp(argv[arg], OPT_MAX_WORDS, strlen(OPT_MAX_WORDS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MAX_WORDS), &value) && value > 0)
+        {
+            max_words = value;
+        }
+        else if (strncmp(argv[arg], OPT_MIN_TIME, strlen(OPT_MIN_TIME)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MIN_TIME), &value))
+        {
+            min_time_ms = value;
+        }
+        else if (strncmp(argv[arg], OPT_MAX_EXPRESSIONS, strlen(OPT_MAX_EXPRESSIONS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MAX_EXPRESSIONS), &value) && value > 0)
+        {
+            max_expressions = value;
+        }
+        else if (strncmp(argv[arg], OPT_SEED, strlen(OPT_SEED)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_SEED), &value))
+        {
+            /* xorshift must not start from zero */
+            random_state = (unsigned long long)value * 0x9E3779B97F4A7C15ULL + 1;
+        }
+        else if (strncmp(argv[arg], OPT_THREADS, strlen(OPT_THREADS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_THREADS), &value) && value > 0)
+        {
+            threads = value;
+        }
+        else if (strncmp(argv[arg], OPT_CASES, strlen(OPT_CASES)) == 0)
+        {
+            case_list = argv[arg] + strlen(OPT_CASES);
+        }
+        else
+        {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (threads > 1 && !thread_pool_start((size_t)(threads - 1)))
+    {
+        fprintf(stderr, "Cannot start %lu threads!\n", threads);
+        return EXIT_FAILURE;
+    }
+
+    /* Random expressions never repeat, cached results would only add copies to the times */
+    memo_set_limit(0);
+
+    if (util_list_contains(case_list, "regress"))
+    {
+        check_regressions(&results[result_count]);
+        fprintf(stderr, "regress: %lu checks, %lu failures\n", results[result_count].checks,
+                results[result_count].failures);
+        failures += results[result_count].failures;
+        result_count++;
+    }
+
+    min_time_ns = (double)min_time_ms * 1e6;
+    size_count = collect_sizes(sizes, (size_t)max_words);
+    for (s = 0; s < size_count && result_count < MAX_RESULTS; s++)
+    {
+        for (k = 0; k <= KERNEL_COUNT && result_count < MAX_RESULTS; k++)
+        {
+            FuzzResult* result = &results[result_count];
+            bool ok;
+
+            if (!util_list_contains(case_list, k < KERNEL_COUNT ? kernels[k].name : "expr")) continue;
+
+            if (k < KERNEL_COUNT) ok = fuzz_kernel(&kernels[k], sizes[s], min_time_ns, result);
+            else ok = fuzz_expressions(sizes[s], min_time_ns, max_expressions, result);
+            if (!ok)
+            {
+                fprintf(stderr, "Case %s failed at %lu words!\n", k < KERNEL_COUNT ? kernels[k].name : "expr",
+                        (unsigned long)sizes[s]);
+                failures++;
+                continue;
+            }
+            fprintf(stderr, "%s %lu words: %lu checks, %lu failures\n", result->name,
+                    (unsigned long)result->words, result->checks, result->failures);
+            failures += result->failures;
+            result_count++;
+        }
+    }
+
+    print_csv(results, result_count);
+
+    thread_pool_stop();
+    bi_free_caches();
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -6,58 +6,247 @@
 #include "bigint.h"
 #include "stack.h"
 #include "parser.h"
+#include "threadpool.h"
+#include "memo.h"
+#include "profile.h"
+#include "util.h"
 
-#define MAX_LINE_BUFFER 2048    /* Max size of row length*/
-#define MAX_EXPR_BUFFER 16384   /* Max multi line expression length */
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define INITIAL_ROW_CAPACITY 256 /* Initial size of row buffers, they grow as needed */
 #define MAX_CMD_NAME 256        /* Max command name length */
 #define BASE_DEC 10             /* Decimal output*/
 #define BASE_HEX 16             /* Hexadecimal output */
 #define BASE_BIN 2              /* Binary output */
+#define BASE_RAW 256            /* Raw format records, see bi_to_raw() */
+#define BASE_DIGITS 0           /* Digit count with the leading and trailing digits */
+#define SUMMARY_EDGE_DIGITS 20  /* Leading and trailing digits shown by "digits" */
+#define OPT_THREADS "--threads="            /* Number of threads working on one huge operation */
+#define OPT_PAR_CUTOFF "--parallel-cutoff=" /* Operand size in words from which threads are used */
+#define OPT_BATCH "--batch"                 /* Rows of a file are evaluated in parallel */
+#define OPT_MEMO_LIMIT "--memo-limit="      /* Memory of the result cache in MiB, 0 disables it */
+#define OPT_PROFILE "--profile"             /* Operators and conversions are timed, see "stats" */
+#define BATCH_WINDOW 1024                   /* Max rows evaluated ahead of the printed one */
+
+/* Copies a text to a new allocation, NULL if out of memory */
+static char* copy_text(const char* text)
+{
+    size_t n = strlen(text) + 1;
+    char* copy = malloc(n);
+
+    if (copy) memcpy(copy, text, n);
+    return copy;
+}
 
-/* Global output system */
-int output_num_system = BASE_DEC;
+/* INPUT ROWS */
 
-void process_and_print(const char* row)
+/* Growable text of one row, the length is kept alongside */
+typedef struct
 {
-    if (!row || strlen(row) < 1) return;
+    char* data;
+    size_t length;
+    size_t capacity;
+} RowBuffer;
+
+/* Makes room for required chars including the terminator, the capacity doubles */
+static bool row_reserve(RowBuffer* row, size_t required)
+{
+    size_t new_capacity;
+    char* new_data;
+
+    if (required <= row->capacity) return true;
+
+    new_capacity = row->capacity ? row->capacity : INITIAL_ROW_CAPACITY;
+    while (new_capacity < required) new_capacity *= 2;
+
+    new_data = realloc(row->data, new_capacity);
+    if (!new_data) return false;
+    row->data = new_data;
+    row->capacity = new_capacity;
+    return true;
+}
+
+static bool row_append(RowBuffer* row, const char* chars, size_t count)
+{
+    if (!row_reserve(row, row->length + count + 1)) return false;
+
+    memcpy(row->data + row->length, chars, count);
+    row->length += count;
+    row->data[row->length] = '\0';
+    return true;
+}
+
+static void row_clear(RowBuffer* row)
+{
+    row->length = 0;
+    if (row->data) row->data[0] = '\0';
+}
+
+/* Hands the text over to the caller, the buffer starts empty again */
+static char* row_release(RowBuffer* row)
+{
+    char* data = row->data;
+
+    row->data = NULL;
+    row->length = row->capacity = 0;
+    return data;
+}
 
+/*
+ * Reads one row of any length without the newline chars. Returns false at
+ * the end of input, or with out_of_memory set if the row cannot grow. The
+ * bytes are counted while reading, so a NUL byte in the row cannot hide its
+ * length; the text ends at the first NUL, as with a fixed buffer.
+ */
+static bool read_row(FILE* f, RowBuffer* row, bool* out_of_memory)
+{
+    int c;
+
+    *out_of_memory = false;
+    row->length = 0;
+
+    while (1)
+    {
+        c = getc(f);
+        if (c == EOF || c == '\n') break;
+
+        /* Room for this char and the terminator */
+        if (!row_reserve(row, row->length + 2))
+        {
+            *out_of_memory = true;
+            return false;
+        }
+        row->data[row->length++] = (char)c;
+    }
+
+    if (c == EOF && row->length == 0) return false;
+    if (!row_reserve(row, row->length + 1))
+    {
+        *out_of_memory = true;
+        return false;
+    }
+
+    /* Deleting the carriage return, the text ends at the first NUL or CR */
+    row->data[row->length] = '\0';
+    row->length = strcspn(row->data, "\r");
+    row->data[row->length] = '\0';
+    return true;
+}
+
+/* Raw records must not get their newline bytes translated */
+static void use_binary_stdout(void)
+{
+#ifdef _WIN32
+    fflush(stdout);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+/* Text of the "stats" command: counters of the result cache and the profile */
+static char* stats_text(void)
+{
+    MemoStats memo;
+    char line[128];
+    char* profile = NULL;
+    char* text;
+    size_t length;
+
+    memo_get_stats(&memo);
+    sprintf(line, "memo: %lu hits, %lu misses, %lu entries, %lu KiB", (unsigned long)memo.hits,
+            (unsigned long)memo.misses, (unsigned long)memo.entries, (unsigned long)(memo.bytes / 1024));
+
+    if (profile_enabled())
+    {
+        profile = profile_report();
+        if (!profile) return NULL;
+    }
+
+    length = strlen(line) + 1 + (profile ? strlen(profile) : strlen("profiling is off, see --profile"));
+    text = (char*)malloc(length + 1);
+    if (text) sprintf(text, "%s\n%s", line, profile ? profile : "profiling is off, see --profile");
+    free(profile);
+    return text;
+}
+
+/* Checks whether a row is the "stats" command, it reports on all rows before it */
+static bool is_stats_command(const char* row)
+{
+    while (*row && isspace((unsigned char)*row)) row++;
+    return strstr(row, "stats") == row;
+}
+
+/*
+ * Handles the commands of a row. Returns true with the output of the command,
+ * or false with the expression to evaluate (the row without leading spaces).
+ */
+static bool run_command(const char* row, int* num_system, char** output, const char** expression)
+{
     /* Ignoring number of rows */
     const char* p = row;
     while (*p && isspace(*p)) p++;
 
+    *output = NULL;
+    *expression = p;
+
     if (strcmp(p, "quit") == 0) {
-        printf("quit\n");
-        return;
+        *output = copy_text("quit");
+        return true;
     }
 
     /* Command "out" writes current num system*/
     if (strstr(p, "out") == p)
     {
-        if (output_num_system == BASE_HEX) printf("hex\n");
-        else if (output_num_system == BASE_BIN) printf("bin\n");
-        else printf("dec\n");
-        return;
+        if (*num_system == BASE_HEX) *output = copy_text("hex");
+        else if (*num_system == BASE_BIN) *output = copy_text("bin");
+        else if (*num_system == BASE_RAW) *output = copy_text("raw");
+        else if (*num_system == BASE_DIGITS) *output = copy_text("digits");
+        else *output = copy_text("dec");
+        return true;
+    }
+
+    if (is_stats_command(p))
+    {
+        *output = stats_text();
+        return true;
     }
 
     if (strstr(p, "hex") == p)
     {
-        output_num_system = BASE_HEX;
-        printf("hex\n");
-        return;
+        *num_system = BASE_HEX;
+        *output = copy_text("hex");
+        return true;
     }
 
     if (strstr(p, "bin") == p)
     {
-        output_num_system = BASE_BIN;
-        printf("bin\n");
-        return;
+        *num_system = BASE_BIN;
+        *output = copy_text("bin");
+        return true;
     }
 
     if (strstr(p, "dec") == p)
     {
-        output_num_system = BASE_DEC;
-        printf("dec\n");
-        return;
+        *num_system = BASE_DEC;
+        *output = copy_text("dec");
+        return true;
+    }
+
+    if (strstr(p, "digits") == p)
+    {
+        *num_system = BASE_DIGITS;
+        *output = copy_text("digits");
+        return true;
+    }
+
+    if (strstr(p, "raw") == p)
+    {
+        use_binary_stdout();
+        *num_system = BASE_RAW;
+        *output = copy_text("raw");
+        return true;
     }
 
 
@@ -80,6 +269,7 @@ void process_and_print(const char* row)
         {
             /* Delete spaces */
             char cmd_name[MAX_CMD_NAME];
+            char message[MAX_CMD_NAME + sizeof("Invalid command \"\"!")];
             strncpy(cmd_name, p, MAX_CMD_NAME - 1);
             cmd_name[MAX_CMD_NAME - 1] = '\0';
 
@@ -90,40 +280,210 @@ void process_and_print(const char* row)
                 n--;
             }
 
-            printf("Invalid command \"%s\"!\n", cmd_name);
-            return;
+            sprintf(message, "Invalid command \"%s\"!", cmd_name);
+            *output = copy_text(message);
+            return true;
         }
     }
+    return false;
+}
 
-    bool error_already_printed = false;
-    BigInt* result = eval_expression(p, &error_already_printed);
+/* Profiling kind of the conversion to an output system */
+static ProfileKind output_kind(int num_system)
+{
+    if (num_system == BASE_HEX) return PROFILE_TO_HEX;
+    if (num_system == BASE_BIN) return PROFILE_TO_BIN;
+    if (num_system == BASE_RAW) return PROFILE_TO_RAW;
+    if (num_system == BASE_DIGITS) return PROFILE_TO_DIGITS;
+    return PROFILE_TO_DEC;
+}
+
+/*
+ * Evaluates an expression, returns the result in the given system or the
+ * error message. Raw records may contain zero bytes, so the size is returned.
+ */
+static char* evaluate_row(const char* expression, int num_system, size_t* size)
+{
+    EvalStatus status;
+    BigInt* result = eval_expression(expression, &status);
+    ProfileSample sample;
+    char* text;
+
+    if (!result)
+    {
+        text = copy_text(eval_status_message(status));
+        if (text) *size = strlen(text);
+        return text;
+    }
+
+    if (profile_enabled()) profile_begin(&sample);
 
-    if (result)
+    if (num_system == BASE_RAW)
+    {
+        text = (char*)bi_to_raw(result, size);
+    }
+    else
     {
-        char* text;
-        if (output_num_system == BASE_HEX) text = bi_to_hex(result);
-        else if (output_num_system == BASE_BIN) text = bi_to_bin(result);
+        if (num_system == BASE_HEX) text = bi_to_hex(result);
+        else if (num_system == BASE_BIN) text = bi_to_bin(result);
+        else if (num_system == BASE_DIGITS) text = bi_to_dec_summary(result, SUMMARY_EDGE_DIGITS);
         else text = bi_to_dec(result);
 
-        if (text)
+        if (text) *size = strlen(text);
+    }
+
+    if (profile_enabled()) profile_end(&sample, output_kind(num_system), result->length);
+    bi_destroy(result);
+    return text;
+}
+
+/* Writes the summary of a result, it is short enough not to be streamed */
+static bool write_summary(const BigInt* result)
+{
+    char* text = bi_to_dec_summary(result, SUMMARY_EDGE_DIGITS);
+    bool ok;
+
+    if (!text) return false;
+    ok = fputs(text, stdout) != EOF;
+    free(text);
+    return ok;
+}
+
+/* Evaluates an expression and streams the result to stdout without building its text */
+static void print_row_result(const char* expression, int num_system)
+{
+    EvalStatus status;
+    BigInt* result = eval_expression(expression, &status);
+    ProfileSample sample;
+    bool ok;
+
+    if (!result)
+    {
+        printf("%s\n", eval_status_message(status));
+        return;
+    }
+
+    /* Streaming interleaves the conversion with the writes, both are timed */
+    if (profile_enabled()) profile_begin(&sample);
+
+    if (num_system == BASE_HEX) ok = bi_write_hex(result, stdout);
+    else if (num_system == BASE_BIN) ok = bi_write_bin(result, stdout);
+    else if (num_system == BASE_RAW) ok = bi_write_raw(result, stdout);
+    else if (num_system == BASE_DIGITS) ok = write_summary(result);
+    else ok = bi_write_dec(result, stdout);
+
+    if (profile_enabled()) profile_end(&sample, output_kind(num_system), result->length);
+    if (ok) printf("\n");
+    bi_destroy(result);
+}
+
+void process_and_print(const char* row, int* num_system)
+{
+    const char* expression;
+    char* output;
+
+    if (!row || strlen(row) < 1) return;
+
+    if (!run_command(row, num_system, &output, &expression))
+    {
+        print_row_result(expression, *num_system);
+        return;
+    }
+
+    if (output)
+    {
+        printf("%s\n", output);
+        free(output);
+    }
+}
+
+/* BATCH MODE */
+
+/*
+ * Row of a batch file. Its expression is evaluated by a pool task with the
+ * output system captured when the row was read, so the rows may finish in any
+ * order and are still printed in the input order.
+ */
+typedef struct
+{
+    char* echo;              /* Row as written after the prompt */
+    const char* expression;  /* Part of echo evaluated by the task, NULL if output is known */
+    int num_system;          /* Output system of the row */
+    char* output;            /* Text printed after the echo, NULL for none */
+    size_t output_size;      /* Bytes of output, raw records may contain zeros */
+    ThreadTask task;
+} BatchRow;
+
+static BatchRow batch_rows[BATCH_WINDOW];
+static size_t batch_count = 0;
+
+static void batch_row_run(void* arg)
+{
+    BatchRow* row = (BatchRow*)arg;
+
+    row->output = evaluate_row(row->expression, row->num_system, &row->output_size);
+}
+
+/* Prints the queued rows in input order, waiting for each one to be evaluated */
+static void batch_flush(void)
+{
+    size_t i;
+
+    for (i = 0; i < batch_count; i++)
+    {
+        BatchRow* row = &batch_rows[i];
+
+        if (row->expression) thread_pool_join(&row->task);
+
+        printf("> %s\n", row->echo);
+        if (row->output)
         {
-            printf("%s\n", text);
-            free(text);
+            fwrite(row->output, 1, row->output_size, stdout);
+            printf("\n");
+            free(row->output);
         }
-        bi_destroy(result);
+        free(row->echo);
+    }
+    batch_count = 0;
+}
+
+/*
+ * Queues a row of a file, taking over its text. Commands run immediately, so
+ * later rows see the system they set.
+ */
+static void batch_add(RowBuffer* text, bool unfinished, int* num_system)
+{
+    BatchRow* row;
+
+    /* The counters shown by "stats" have to include all rows before it */
+    if (batch_count == BATCH_WINDOW || (!unfinished && is_stats_command(text->data))) batch_flush();
+
+    row = &batch_rows[batch_count++];
+    row->echo = row_release(text);
+    row->expression = NULL;
+    row->output = NULL;
+
+    /* In file mode: unfinished expression at line end is syntax error */
+    if (unfinished)
+    {
+        row->output = copy_text("Syntax error!");
+    }
+    else if (run_command(row->echo, num_system, &row->output, &row->expression))
+    {
+        row->expression = NULL;
     }
     else
     {
-        if (!error_already_printed)
-        {
-            printf("Syntax error!\n");
-        }
+        row->num_system = *num_system;
+        row->output_size = 0;
+        thread_pool_spawn(&row->task, batch_row_run, row);
     }
+
+    if (!row->expression && row->output) row->output_size = strlen(row->output);
 }
 
-bool is_unfinished(const char* text)
+bool is_unfinished(const char* text, size_t n)
 {
-    size_t n = strlen(text);
     char c;
 
     if (n == 0) return false;
@@ -136,7 +496,7 @@ bool is_unfinished(const char* text)
 
     c = text[n - 1];
 
-    if (strchr("+-*/%^(", c))
+    if (strchr("+-*/%^(,", c))
     {
         return true;
     }
@@ -167,65 +527,108 @@ bool is_unfinished(const char* text)
 
 int main(int argc, char* argv[])
 {
-    char row[MAX_LINE_BUFFER];
+    RowBuffer row = { NULL, 0, 0 };
     /* Buffer for fusing multiple rows */
-    char accumulated_row[MAX_EXPR_BUFFER];
-    accumulated_row[0] = '\0';
+    RowBuffer accumulated_row = { NULL, 0, 0 };
+    bool out_of_memory = false;
+    const char* input_path = NULL;
+    int num_system = BASE_DEC;
+    bool batch = false;
+    unsigned long threads = 1;
+    unsigned long value;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strncmp(argv[arg], OPT_THREADS, strlen(OPT_THREADS)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_THREADS), &value) && value > 0)
+        {
+            threads = value;
+        }
+        else if (strncmp(argv[arg], OPT_PAR_CUTOFF, strlen(OPT_PAR_CUTOFF)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_PAR_CUTOFF), &value))
+        {
+            bi_set_parallel_threshold((size_t)value);
+        }
+        else if (strncmp(argv[arg], OPT_MEMO_LIMIT, strlen(OPT_MEMO_LIMIT)) == 0 &&
+            util_parse_option_value(argv[arg] + strlen(OPT_MEMO_LIMIT), &value) &&
+            value <= (size_t)-1 / (1024 * 1024))
+        {
+            memo_set_limit((size_t)value * 1024 * 1024);
+        }
+        else if (strcmp(argv[arg], OPT_BATCH) == 0)
+        {
+            batch = true;
+        }
+        else if (strcmp(argv[arg], OPT_PROFILE) == 0)
+        {
+            profile_set_enabled(true);
+        }
+        else if (strncmp(argv[arg], "--", 2) == 0 || input_path)
+        {
+            printf("Invalid option \"%s\"!\n", argv[arg]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            input_path = argv[arg];
+        }
+    }
 
-    if (argc > 1)
+    /* The calling thread works too, the pool adds the others */
+    if (threads > 1 && !thread_pool_start((size_t)(threads - 1)))
     {
-        FILE* f = fopen(argv[1], "r");
+        printf("Cannot start %lu threads!\n", threads);
+        return EXIT_FAILURE;
+    }
+
+    if (input_path)
+    {
+        FILE* f = fopen(input_path, "r");
         if (!f)
         {
             printf("Invalid input file!\n");
+            thread_pool_stop();
             return EXIT_FAILURE;
         }
 
-        while (fgets(row, sizeof(row), f))
+        while (read_row(f, &row, &out_of_memory))
         {
-            /* Deleting the newline chars */
-            row[strcspn(row, "\r\n")] = 0;
-
-            if (strcmp(row, "quit") == 0) {
+            if (strcmp(row.data, "quit") == 0) {
+                batch_flush();
                 printf("> quit\n");
                 printf("quit\n");
                 break;
             }
 
-            /* If row is empty, and we have nothing ongoing, ignore it */
-            if (strlen(row) == 0 && strlen(accumulated_row) == 0) continue;
+            /* Empty rows are ignored, every other row is a whole expression */
+            if (row.length == 0) continue;
 
-            /* If not too big, fuse the rows */
-            if (strlen(accumulated_row) + strlen(row) >= MAX_EXPR_BUFFER)
+            if (batch)
             {
-                return EXIT_FAILURE;
+                batch_add(&row, is_unfinished(row.data, row.length), &num_system);
             }
-            strcat(accumulated_row, row);
-
-            if (is_unfinished(accumulated_row))
+            else if (is_unfinished(row.data, row.length))
             {
                 /* In file mode: unfinished expression at line end is syntax error */
-                printf("> %s\n", accumulated_row);
+                printf("> %s\n", row.data);
                 printf("Syntax error!\n");
-                accumulated_row[0] = '\0';
             }
             else
             {
-                printf("> %s\n", accumulated_row);
-                process_and_print(accumulated_row);
-                accumulated_row[0] = '\0';
+                printf("> %s\n", row.data);
+                process_and_print(row.data, &num_system);
             }
         }
-        
-        /* After reading whole file, process any remaining incomplete expression */
-        if (strlen(accumulated_row) > 0)
+        batch_flush();
+        fclose(f);
+
+        if (out_of_memory)
         {
-            printf("> %s\n", accumulated_row);
-            process_and_print(accumulated_row);
-            accumulated_row[0] = '\0';
+            free(row.data);
+            thread_pool_stop();
+            return EXIT_FAILURE;
         }
-        
-        fclose(f);
     }
 
     /* Interaction mode */
@@ -234,42 +637,55 @@ int main(int argc, char* argv[])
         while (1)
         {
             /* If something is ongoing, write a different prompt */
-            if (strlen(accumulated_row) > 0) printf("... ");
+            if (accumulated_row.length > 0) printf("... ");
             else printf("> ");
 
-            if (!fgets(row, sizeof(row), stdin)) break;
-            row[strcspn(row, "\r\n")] = 0;
+            if (!read_row(stdin, &row, &out_of_memory)) break;
 
-            if (strcmp(row, "quit") == 0) {
+            if (strcmp(row.data, "quit") == 0) {
                 printf("quit\n");
                 break;
             }
 
-            if (strlen(accumulated_row) + strlen(row) >= MAX_EXPR_BUFFER)
+            /* If it fits into memory, fuse the rows */
+            if (!row_append(&accumulated_row, row.data, row.length))
             {
-                accumulated_row[0] = '\0';
+                row_clear(&accumulated_row);
                 continue;
             }
 
-            strcat(accumulated_row, row);
-
-            if (is_unfinished(accumulated_row))
+            if (is_unfinished(accumulated_row.data, accumulated_row.length))
             {
-                size_t n = strlen(accumulated_row);
-                char last = accumulated_row[n - 1];
+                char last = accumulated_row.data[accumulated_row.length - 1];
 
                 if (last != 'x' && last != 'X' && last != 'b' && last != 'B')
                 {
-                    strcat(accumulated_row, " ");
+                    row_append(&accumulated_row, " ", 1);
                 }
 
                 continue;
             }
 
-            process_and_print(accumulated_row);
-            accumulated_row[0] = '\0';
+            process_and_print(accumulated_row.data, &num_system);
+            row_clear(&accumulated_row);
         }
     }
 
+    free(row.data);
+    free(accumulated_row.data);
+    thread_pool_stop();
+
+    /* The summary goes to stderr, so the results stay comparable */
+    if (profile_enabled())
+    {
+        char* report = stats_text();
+        if (report)
+        {
+            fprintf(stderr, "%s\n", report);
+            free(report);
+        }
+    }
+    memo_clear();
+    bi_free_caches();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
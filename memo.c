@@ -0,0 +1,292 @@
+/**
+ * @file memo.c
+ * @brief Implementation of the memoization cache.
+ * * Entries are chained in a fixed hash table and linked in a list from the
+ * most to the least recently used one. One mutex guards the whole cache;
+ * values are copied outside of it. A lookup pins its entry while it copies
+ * the result, an entry evicted meanwhile is freed by the last reader.
+ */
+
+#include "memo.h"
+#include <pthread.h>
+#include <string.h>
+
+#define MEMO_BUCKETS 1024  /* Number of hash chains, a power of two */
+
+typedef struct MemoEntry
+{
+    char op;
+    BigInt* left;                   /* NULL for unary operators */
+    BigInt* right;
+    BigInt* result;
+    size_t hash;
+    size_t bytes;                   /* Memory of the three values */
+    size_t readers;                 /* Lookups copying the result outside of the lock */
+    bool evicted;                   /* Detached while pinned, freed by the last reader */
+    struct MemoEntry* next_in_bucket;
+    struct MemoEntry* newer;        /* Towards the most recently used entry */
+    struct MemoEntry* older;
+} MemoEntry;
+
+static MemoEntry* buckets[MEMO_BUCKETS];
+static MemoEntry* newest = NULL;
+static MemoEntry* oldest = NULL;
+static size_t memo_limit = MEMO_DEFAULT_LIMIT;
+static MemoStats memo_stats = { 0, 0, 0, 0 };
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* HELP FUNCTIONS */
+
+static size_t memo_hash_value(size_t hash, const BigInt* value)
+{
+    /* FNV-1a over the sign and the digit bytes */
+    const unsigned char* bytes;
+    size_t i;
+
+    if (!value) return hash * 31u;
+
+    hash = (hash ^ (size_t)(value->sign + 1)) * 16777619u;
+    bytes = (const unsigned char*)value->digits;
+    for (i = 0; i < value->length * sizeof(bi_word); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t memo_hash(char op, const BigInt* left, const BigInt* right)
+{
+    size_t hash = 2166136261u ^ (unsigned char)op;
+
+    hash = memo_hash_value(hash, left);
+    return memo_hash_value(hash, right);
+}
+
+static bool memo_equal(const BigInt* a, const BigInt* b)
+{
+    if (!a || !b) return a == b;
+    return a->sign == b->sign && bi_compare_abs(a, b) == 0;
+}
+
+static size_t memo_value_bytes(const BigInt* value)
+{
+    if (!value) return 0;
+    return sizeof(BigInt) + (value->length > BI_INLINE_WORDS ? value->length * sizeof(bi_word) : 0);
+}
+
+/* Finds an entry. Lock is held. */
+static MemoEntry* memo_find(size_t hash, char op, const BigInt* left, const BigInt* right)
+{
+    MemoEntry* entry;
+
+    for (entry = buckets[hash & (MEMO_BUCKETS - 1)]; entry; entry = entry->next_in_bucket)
+    {
+        if (entry->hash == hash && entry->op == op &&
+            memo_equal(entry->left, left) && memo_equal(entry->right, right))
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Removes an entry from the recency list. Lock is held. */
+static void memo_unlink(MemoEntry* entry)
+{
+    if (entry->newer) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+/* Makes an entry the most recently used one. Lock is held. */
+static void memo_link_newest(MemoEntry* entry)
+{
+    entry->older = newest;
+    entry->newer = NULL;
+    if (newest) newest->newer = entry;
+    newest = entry;
+    if (!oldest) oldest = entry;
+}
+
+static void memo_destroy_entry(MemoEntry* entry)
+{
+    bi_destroy(entry->left);
+    bi_destroy(entry->right);
+    bi_destroy(entry->result);
+    free(entry);
+}
+
+/*
+ * Detaches the least recently used entries until the cache fits into the
+ * limit. The detached entries are chained by next_in_bucket, pinned ones are
+ * only marked and left to their last reader. Lock is held.
+ */
+static MemoEntry* memo_evict(size_t limit)
+{
+    MemoEntry* evicted = NULL;
+    MemoEntry* entry;
+    MemoEntry** link;
+
+    while (oldest && memo_stats.bytes > limit)
+    {
+        entry = oldest;
+        memo_unlink(entry);
+
+        link = &buckets[entry->hash & (MEMO_BUCKETS - 1)];
+        while (*link != entry) link = &(*link)->next_in_bucket;
+        *link = entry->next_in_bucket;
+
+        memo_stats.bytes -= entry->bytes;
+        memo_stats.entries--;
+        if (entry->readers > 0)
+        {
+            entry->evicted = true;
+            continue;
+        }
+        entry->next_in_bucket = evicted;
+        evicted = entry;
+    }
+    return evicted;
+}
+
+static void memo_destroy_chain(MemoEntry* entry)
+{
+    MemoEntry* next;
+
+    while (entry)
+    {
+        next = entry->next_in_bucket;
+        memo_destroy_entry(entry);
+        entry = next;
+    }
+}
+
+/* CACHE FUNCTIONS */
+
+bool memo_lookup(BigInt* dst, char op, const BigInt* left, const BigInt* right)
+{
+    MemoEntry* entry = NULL;
+    bool found = false;
+    bool last_reader;
+    size_t hash;
+
+    if (!right) return false;
+
+    hash = memo_hash(op, left, right);
+
+    pthread_mutex_lock(&memo_lock);
+    if (memo_limit > 0)
+    {
+        entry = memo_find(hash, op, left, right);
+        if (entry)
+        {
+            memo_unlink(entry);
+            memo_link_newest(entry);
+            entry->readers++;
+        }
+        else
+        {
+            memo_stats.misses++;
+        }
+    }
+    pthread_mutex_unlock(&memo_lock);
+    if (!entry) return false;
+
+    /* The pinned entry stays valid even if it is evicted during the copy */
+    found = bi_set(dst, entry->result);
+
+    pthread_mutex_lock(&memo_lock);
+    if (found) memo_stats.hits++;
+    else memo_stats.misses++;
+    entry->readers--;
+    last_reader = entry->readers == 0 && entry->evicted;
+    pthread_mutex_unlock(&memo_lock);
+
+    if (last_reader) memo_destroy_entry(entry);
+    return found;
+}
+
+void memo_store(char op, const BigInt* left, const BigInt* right, const BigInt* result)
+{
+    MemoEntry* entry;
+    MemoEntry* evicted = NULL;
+    size_t bytes;
+
+    if (!right || !result) return;
+
+    bytes = sizeof(MemoEntry) + memo_value_bytes(left) + memo_value_bytes(right) + memo_value_bytes(result);
+
+    /* A result exceeding the whole limit is not copied at all */
+    pthread_mutex_lock(&memo_lock);
+    if (bytes > memo_limit)
+    {
+        pthread_mutex_unlock(&memo_lock);
+        return;
+    }
+    pthread_mutex_unlock(&memo_lock);
+
+    entry = (MemoEntry*)calloc(1, sizeof(MemoEntry));
+    if (!entry) return;
+    entry->op = op;
+    entry->left = left ? bi_copy(left) : NULL;
+    entry->right = bi_copy(right);
+    entry->result = bi_copy(result);
+    entry->hash = memo_hash(op, left, right);
+    entry->bytes = bytes;
+    if ((left && !entry->left) || !entry->right || !entry->result)
+    {
+        memo_destroy_entry(entry);
+        return;
+    }
+
+    pthread_mutex_lock(&memo_lock);
+    if (bytes > memo_limit || memo_find(entry->hash, op, left, right))
+    {
+        /* Limit lowered or stored by another thread meanwhile */
+        pthread_mutex_unlock(&memo_lock);
+        memo_destroy_entry(entry);
+        return;
+    }
+
+    entry->next_in_bucket = buckets[entry->hash & (MEMO_BUCKETS - 1)];
+    buckets[entry->hash & (MEMO_BUCKETS - 1)] = entry;
+    memo_link_newest(entry);
+    memo_stats.bytes += bytes;
+    memo_stats.entries++;
+    evicted = memo_evict(memo_limit);
+    pthread_mutex_unlock(&memo_lock);
+
+    memo_destroy_chain(evicted);
+}
+
+void memo_set_limit(size_t bytes)
+{
+    MemoEntry* evicted;
+
+    pthread_mutex_lock(&memo_lock);
+    memo_limit = bytes;
+    evicted = memo_evict(memo_limit);
+    pthread_mutex_unlock(&memo_lock);
+
+    memo_destroy_chain(evicted);
+}
+
+void memo_get_stats(MemoStats* stats)
+{
+    pthread_mutex_lock(&memo_lock);
+    *stats = memo_stats;
+    pthread_mutex_unlock(&memo_lock);
+}
+
+void memo_clear(void)
+{
+    MemoEntry* evicted;
+
+    pthread_mutex_lock(&memo_lock);
+    evicted = memo_evict(0);
+    pthread_mutex_unlock(&memo_lock);
+
+    memo_destroy_chain(evicted);
+}
@@ -0,0 +1,68 @@
+/**
+ * @file memo.h
+ * @brief Memoization cache for results of expensive operations.
+ * * Results are keyed by the operator and the values of its operands and
+ * are kept in least recently used order under a memory limit. The cache is
+ * shared by all threads.
+ */
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "bigint.h"
+
+#define MEMO_DEFAULT_LIMIT ((size_t)64 * 1024 * 1024) /* Default memory limit in bytes */
+
+/**
+ * @struct MemoStats
+ * @brief Counters of the cache.
+ * @var MemoStats::hits Lookups answered from the cache.
+ * @var MemoStats::misses Lookups that found nothing.
+ * @var MemoStats::entries Number of cached results.
+ * @var MemoStats::bytes Memory held by the cached values.
+ */
+typedef struct
+{
+    size_t hits;
+    size_t misses;
+    size_t entries;
+    size_t bytes;
+} MemoStats;
+
+/**
+ * @brief Looks up the result of an operation and copies it into dst.
+ * @param dst Receives the result, may alias an operand.
+ * @param op Operator character.
+ * @param left Left operand, NULL for unary operators.
+ * @param right Right (or only) operand.
+ * @return true if the result was cached and copied, false otherwise.
+ */
+bool memo_lookup(BigInt* dst, char op, const BigInt* left, const BigInt* right);
+
+/**
+ * @brief Stores the result of an operation, evicting the least recently used ones over the limit.
+ * @param op Operator character.
+ * @param left Left operand, NULL for unary operators.
+ * @param right Right (or only) operand.
+ * @param result Result to store, the cache keeps its own copy.
+ */
+void memo_store(char op, const BigInt* left, const BigInt* right, const BigInt* result);
+
+/**
+ * @brief Sets the memory limit of the cache, evicting results over it.
+ * @param bytes New limit in bytes, 0 disables the cache.
+ */
+void memo_set_limit(size_t bytes);
+
+/**
+ * @brief Reads the counters of the cache.
+ * @param stats Receives the counters.
+ */
+void memo_get_stats(MemoStats* stats);
+
+/**
+ * @brief Frees all cached results.
+ */
+void memo_clear(void);
+
+#endif /* MEMO_H */
@@ -1,19 +1,38 @@
 /**
 * @file parser.c
  * @brief Mathematical expression parser and evaluator.
- * * Implements the Shunting-yard algorithm to convert infix expressions
- * to RPN and evaluates them using BigInt arithmetic.
+ * * Implements the Shunting-yard algorithm to compile infix expressions
+ * to RPN code, folding constant operations, and executes the code using
+ * BigInt arithmetic.
  */
 
 #include "parser.h"
 #include "stack.h"
+#include "memo.h"
+#include "profile.h"
 #include <ctype.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define INITIAL_STACK_SIZE 32
-#define INITIAL_NUMBER_BUFFER_SIZE 32
+#define INITIAL_CODE_SIZE 16
+#define MEMO_MIN_WORDS 64 /* Results from this size in words are memoized */
+
+/* Working memory of the compiler and the executor, reused between expressions */
+typedef struct
+{
+    CharStack* op_stack;        /* Created on first use, like the others */
+    BigIntStack* num_stack;
+    size_t* commas_left;        /* One counter per possible open parenthesis */
+    size_t commas_capacity;
+} EvalScratch;
+
+static void scratch_release(EvalScratch* scratch)
+{
+    char_stack_destroy(scratch->op_stack);
+    stack_destroy(scratch->num_stack, true);
+    free(scratch->commas_left);
+}
 
 static bool is_operator(char c)
 {
@@ -21,10 +40,26 @@ static bool is_operator(char c)
            c == '%' || c == '^' || c == '!' || c == '(' || c == ')';
 }
 
-static bool validate_expression_syntax(const char* input)
+/* Operator character of a function name, 0 if there is no such function */
+static char function_op(const char* name, size_t length)
 {
-    if (!input) return false;
+    if (length == strlen("powmod") && strncmp(name, "powmod", length) == 0) return EXPR_POWMOD;
+    return 0;
+}
 
+/* Number of operands an operator takes from the stack */
+static size_t operator_arity(char op)
+{
+    if (op == EXPR_POWMOD || op == EXPR_MULMOD) return 3;
+    return (op == '!' || op == 'm') ? 1 : 2;
+}
+
+/*
+ * Checks the syntax. For every open parenthesis, commas_left holds the number
+ * of argument separators still expected (0 for plain parentheses).
+ */
+static bool validate_tokens(const char* input, size_t* commas_left)
+{
     int i = 0;
     bool expect_operand = true;
     bool last_was_operator = false;
@@ -39,6 +74,40 @@ static bool validate_expression_syntax(const char* input)
             continue;
         }
 
+        /* Function call, its name must be followed by the parenthesis */
+        if (isalpha((unsigned char)input[i]))
+        {
+            int start = i;
+            char op;
+
+            while (isalpha((unsigned char)input[i])) i++;
+            op = function_op(input + start, (size_t)(i - start));
+            if (!op || !expect_operand) return false;
+
+            while (isspace((unsigned char)input[i])) i++;
+            if (input[i] != '(') return false;
+
+            commas_left[paren_depth++] = operator_arity(op) - 1;
+            i++;
+            expect_operand = true;
+            last_was_operator = true;
+            continue;
+        }
+
+        /* Comma separates function arguments */
+        if (input[i] == ',')
+        {
+            if (expect_operand || paren_depth <= 0 || commas_left[paren_depth - 1] == 0)
+            {
+                return false;
+            }
+            commas_left[paren_depth - 1]--;
+            i++;
+            expect_operand = true;
+            last_was_operator = true;
+            continue;
+        }
+
         /* Check for numbers */
         if (isdigit(input[i]))
         {
@@ -85,15 +154,16 @@ static bool validate_expression_syntax(const char* input)
                     return false;
                 }
                 i++;
-                paren_depth++;
+                commas_left[paren_depth++] = 0;
                 expect_operand = true;
                 last_was_operator = true;
                 continue;
             }
             else if (input[i] == ')')
             {
-                if (expect_operand || paren_depth <= 0)
+                if (expect_operand || paren_depth <= 0 || commas_left[paren_depth - 1] != 0)
                 {
+                    /* Also a function call with too few arguments */
                     return false;
                 }
                 i++;
@@ -126,20 +196,20 @@ static bool validate_expression_syntax(const char* input)
                     {
                         if (input[i] == '-')  /* Minus */
                         {
-                            /* Minus can be unary after '(' or any operator */
-                            if (input[j] != '(' && !is_operator(input[j]))
+                            /* Minus can be unary after '(', ',' or any operator but ')' and '!' */
+                            if (input[j] != '(' && input[j] != ',' && !is_operator(input[j]))
                             {
                                 is_unary = false;
                             }
-                            if (input[j] == '!')
+                            if (input[j] == '!' || input[j] == ')')
                             {
                                 is_unary = false;
                             }
                         }
                         else  /* Plus */
                         {
-                            /* Plus can be unary only after '(' */
-                            if (input[j] != '(')
+                            /* Plus can be unary only after '(' or ',' */
+                            if (input[j] != '(' && input[j] != ',')
                             {
                                 is_unary = false;
                             }
@@ -190,6 +260,26 @@ static bool validate_expression_syntax(const char* input)
     return true;
 }
 
+static bool validate_expression_syntax(const char* input, EvalScratch* scratch)
+{
+    size_t needed;
+    size_t* commas_left;
+
+    if (!input) return false;
+
+    /* No more parentheses can be open than there are characters */
+    needed = strlen(input) + 1;
+    if (needed > scratch->commas_capacity)
+    {
+        commas_left = (size_t*)realloc(scratch->commas_left, needed * sizeof(size_t));
+        if (!commas_left) return false;
+        scratch->commas_left = commas_left;
+        scratch->commas_capacity = needed;
+    }
+
+    return validate_tokens(input, scratch->commas_left);
+}
+
 static int get_priority(char op)
 {
     switch (op)
@@ -206,7 +296,48 @@ static int get_priority(char op)
     }
 }
 
-static bool apply_operation(BigIntStack* num_stack, char op, bool* error_already_printed)
+/* Estimates whether an operation is expensive enough to be memoized */
+static bool memo_worth(char op, const BigInt* left, const BigInt* right)
+{
+    size_t bits;
+
+    if (right->length != 1) return false;
+
+    if (op == '!')
+    {
+        /* n! has about n * log2(n) bits */
+        bits = (size_t)right->digits[0] * bi_bit_length(right);
+    }
+    else if (op == '^' && right->sign > 0)
+    {
+        bits = bi_bit_length(left) * (size_t)right->digits[0];
+    }
+    else
+    {
+        return false;
+    }
+    return bits >= MEMO_MIN_WORDS * sizeof(bi_word) * 8;
+}
+
+/* Raises left to the power of right in place, large powers go through the memo cache */
+static bool apply_power(BigInt* left, BigInt* right)
+{
+    BigInt* power;
+    bool ok;
+
+    if (!memo_worth('^', left, right)) return bi_pow_to(left, left, right);
+    if (memo_lookup(left, '^', left, right)) return true;
+
+    power = bi_pow(left, right);
+    if (!power) return false;
+    memo_store('^', left, right, power);
+
+    ok = bi_set(left, power);
+    bi_destroy(power);
+    return ok;
+}
+
+static bool run_operation(BigIntStack* num_stack, char op, EvalStatus* status)
 {
     if (stack_is_empty(num_stack)) return false;
     BigInt* result = NULL;
@@ -216,29 +347,60 @@ static bool apply_operation(BigIntStack* num_stack, char op, bool* error_already
     {
         if (right->sign == -1)
         {
-            printf("Input of factorial must not be negative!\n");
-            *error_already_printed = true;
+            *status = EVAL_NEGATIVE_FACTORIAL;
             bi_destroy(right);
             return false;
         }
-        if (right->length > 1)
+        /* bi_fact() takes a 32-bit argument whatever the word width is */
+        if (right->length > 1 || right->digits[0] > UINT32_MAX)
         {
             bi_destroy(right);
             return false;
         }
-        result = bi_fact(right->digits[0]);
-        bi_destroy(right);
+        if (memo_worth(op, NULL, right) && memo_lookup(right, op, NULL, right))
+        {
+            result = right;
+        }
+        else
+        {
+            result = bi_fact((uint32_t)right->digits[0]);
+            if (result && memo_worth(op, NULL, right)) memo_store(op, NULL, right, result);
+            bi_destroy(right);
+        }
     }
-    else if (op == 'm')
+    else if (op == EXPR_POWMOD || op == EXPR_MULMOD)
     {
-        BigInt* res = bi_negate(right);
+        /* The modulus is on the top, the left operand receives the result */
+        BigInt* middle = stack_pop(num_stack);
+        BigInt* left = stack_pop(num_stack);
+        bool ok = false;
+
+        if (!left)
+        {
+            bi_destroy(middle);
+            bi_destroy(right);
+            return false;
+        }
+
+        if (right->sign == 0) *status = EVAL_DIVISION_BY_ZERO;
+        else if (op == EXPR_POWMOD) ok = bi_powmod_to(left, left, middle, right);
+        else ok = bi_mulmod_to(left, left, middle, right);
+
+        bi_destroy(middle);
         bi_destroy(right);
-        if (res)
+        if (!ok)
         {
-            stack_push(num_stack, res);
-            return true;
+            bi_destroy(left);
+            return false;
         }
-        return false;
+        result = left;
+    }
+    else if (op == 'm')
+    {
+        /* The popped operand is negated in place and pushed back */
+        bi_negate_to(right, right);
+        stack_push(num_stack, right);
+        return true;
     }
     else
     {
@@ -248,37 +410,44 @@ static bool apply_operation(BigIntStack* num_stack, char op, bool* error_already
             return false;
         }
         BigInt* left = stack_pop(num_stack);
+        bool ok = false;
 
         /* Division by zero */
         if ((op == '/' || op == '%') && right->sign == 0)
         {
-            printf("Division by zero!\n");
-            *error_already_printed = true;
+            *status = EVAL_DIVISION_BY_ZERO;
 
             bi_destroy(left);
             bi_destroy(right);
             return false;
         }
 
+        /* The left operand receives the result */
         switch (op)
         {
-        case '+': result = bi_add(left, right);
+        case '+': ok = bi_add_to(left, left, right);
             break;
-        case '-': result = bi_sub(left, right);
+        case '-': ok = bi_sub_to(left, left, right);
             break;
-        case '*': result = bi_mul(left, right);
+        case '*': ok = bi_mul_to(left, left, right);
             break;
-        case '/': result = bi_div(left, right);
+        case '/': ok = bi_div_to(left, left, right);
             break;
-        case '%': result = bi_mod(left, right);
+        case '%': ok = bi_mod_to(left, left, right);
             break;
-        case '^': result = bi_pow(left, right);
+        case '^': ok = apply_power(left, right);
             break;
 
         default: break;
         }
-        bi_destroy(left);
         bi_destroy(right);
+
+        if (!ok)
+        {
+            bi_destroy(left);
+            return false;
+        }
+        result = left;
     }
 
     if (result)
@@ -289,20 +458,223 @@ static bool apply_operation(BigIntStack* num_stack, char op, bool* error_already
     return false;
 }
 
-BigInt* eval_expression(const char* input, bool* error_already_printed)
+/* Words of the largest operand the operator takes from the stack */
+static size_t operand_words(const BigIntStack* num_stack, char op)
 {
-    if (!input) return NULL;
+    int operands = (int)operator_arity(op);
+    size_t words = 0;
+    int i;
 
-    if (!validate_expression_syntax(input)) return NULL;
+    for (i = 0; i < operands && num_stack->top - i >= 0; i++)
+    {
+        if (num_stack->data[num_stack->top - i]->length > words)
+        {
+            words = num_stack->data[num_stack->top - i]->length;
+        }
+    }
+    return words;
+}
+
+/* Applies an operator to the top of the stack, recording it while profiling is on */
+static bool apply_operation(BigIntStack* num_stack, char op, EvalStatus* status)
+{
+    ProfileSample sample;
+    size_t words;
+    bool ok;
+
+    if (!profile_enabled()) return run_operation(num_stack, op, status);
+
+    words = operand_words(num_stack, op);
+    profile_begin(&sample);
+    ok = run_operation(num_stack, op, status);
+    profile_end(&sample, profile_operator_kind(op), words);
+    return ok;
+}
 
-    BigIntStack* num_stack = stack_create(INITIAL_STACK_SIZE);
-    if (!num_stack) return NULL;
-    CharStack* op_stack = char_stack_create(INITIAL_STACK_SIZE);
-    if (!op_stack)
+/* COMPILED EXPRESSIONS */
+
+/* Converts a validated literal straight from the input, the prefix picks the system */
+static BigInt* parse_literal(const char* start, size_t length)
+{
+    ProfileSample sample;
+    ProfileKind kind = PROFILE_FROM_DEC;
+    BigInt* value;
+
+    if (profile_enabled()) profile_begin(&sample);
+
+    if (length > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X'))
     {
-        stack_destroy(num_stack, true);
-        return NULL;
+        kind = PROFILE_FROM_HEX;
+        value = bi_from_hex_n(start + 2, length - 2);
+    }
+    else if (length > 2 && start[0] == '0' && (start[1] == 'b' || start[1] == 'B'))
+    {
+        kind = PROFILE_FROM_BIN;
+        value = bi_from_bin_n(start + 2, length - 2);
+    }
+    else
+    {
+        value = bi_from_dec_n(start, length);
+    }
+
+    if (profile_enabled()) profile_end(&sample, kind, value ? value->length : 0);
+    return value;
+}
+
+static bool expr_emit(CompiledExpr* expr, char op, BigInt* value)
+{
+    if (expr->length == expr->capacity)
+    {
+        size_t new_capacity = expr->capacity ? expr->capacity * 2 : INITIAL_CODE_SIZE;
+        ExprInstr* new_code = realloc(expr->code, new_capacity * sizeof(ExprInstr));
+        if (!new_code) return false;
+        expr->code = new_code;
+        expr->capacity = new_capacity;
+    }
+
+    expr->code[expr->length].op = op;
+    expr->code[expr->length].value = value;
+    expr->code[expr->length].error = EVAL_OK;
+    expr->length++;
+    return true;
+}
+
+/*
+ * Emits an operator. If all its operands are literals, it is evaluated right
+ * away: the result replaces them as a new literal, or if the operation fails
+ * an error instruction repeats its status on every execution.
+ */
+static bool expr_emit_operator(CompiledExpr* expr, char op)
+{
+    size_t arity = operator_arity(op);
+    size_t first, i;
+    BigIntStack* operands;
+    EvalStatus status = EVAL_OK;
+
+    if (expr->length < arity) return expr_emit(expr, op, NULL);
+
+    first = expr->length - arity;
+    for (i = first; i < expr->length; i++)
+    {
+        if (expr->code[i].op != EXPR_LITERAL) return expr_emit(expr, op, NULL);
+    }
+
+    operands = stack_create((int)arity);
+    if (!operands) return expr_emit(expr, op, NULL);
+
+    /* The literals are handed over to the stack */
+    for (i = first; i < expr->length; i++)
+    {
+        stack_push(operands, expr->code[i].value);
     }
+    expr->length = first;
+
+    /* The freed slots leave room, so the emits below cannot fail */
+    if (apply_operation(operands, op, &status))
+    {
+        /* The constant lives as long as the code, its spare capacity is returned */
+        bi_shrink_to_fit(stack_peek(operands));
+        expr_emit(expr, EXPR_LITERAL, stack_pop(operands));
+    }
+    else
+    {
+        expr_emit(expr, EXPR_ERROR, NULL);
+        expr->code[first].error = status == EVAL_OK ? EVAL_SYNTAX_ERROR : status;
+    }
+    stack_destroy(operands, true);
+    return true;
+}
+
+/* Change of the stack depth by an instruction */
+static long instr_effect(const ExprInstr* instr)
+{
+    if (instr->op == EXPR_LITERAL || instr->op == EXPR_ERROR) return 1;
+    return 1 - (long)operator_arity(instr->op);
+}
+
+/*
+ * Fuses a power or a product whose result is immediately reduced, a^b % m and
+ * a*b % m, into one modular instruction. The operands keep their code, only
+ * the '^' or '*' between them is dropped, so the full intermediate is never
+ * built. Both kernels give the truncated remainder like '%' does.
+ */
+static void expr_fuse_modular(CompiledExpr* expr)
+{
+    size_t k, start;
+    long depth;
+    char left;
+
+    for (k = 0; k < expr->length; k++)
+    {
+        if (expr->code[k].op != '%') continue;
+
+        /* The divisor is the shortest code before the '%' that leaves one value */
+        depth = 0;
+        start = k;
+        while (start > 0 && depth < 1)
+        {
+            depth += instr_effect(&expr->code[--start]);
+        }
+        if (depth != 1 || start == 0) continue;
+
+        left = expr->code[start - 1].op;
+        if (left != '^' && left != '*') continue;
+
+        memmove(&expr->code[start - 1], &expr->code[start], (expr->length - start) * sizeof(ExprInstr));
+        expr->length--;
+        k--;
+        expr->code[k].op = left == '^' ? EXPR_POWMOD : EXPR_MULMOD;
+    }
+}
+
+/*
+ * Fuses modular patterns, then folds constant operations by emitting the
+ * code again in place. Folding only shrinks the code, so it cannot fail.
+ */
+static void expr_optimize(CompiledExpr* expr)
+{
+    size_t count, i;
+    ExprInstr instr;
+
+    expr_fuse_modular(expr);
+
+    count = expr->length;
+    expr->length = 0;
+    for (i = 0; i < count; i++)
+    {
+        /* Copied first, the slot may be overwritten by the emit */
+        instr = expr->code[i];
+        if (instr.op == EXPR_LITERAL) expr_emit(expr, EXPR_LITERAL, instr.value);
+        else expr_emit_operator(expr, instr.op);
+    }
+}
+
+/* Frees the literals of a compiled expression, keeping its code array for reuse */
+static void expr_reset(CompiledExpr* expr)
+{
+    size_t i;
+
+    for (i = 0; i < expr->length; i++)
+    {
+        bi_destroy(expr->code[i].value);
+    }
+    expr->length = 0;
+}
+
+/* Compiles input into an empty expr, on failure expr is left empty */
+static bool expr_compile_into(CompiledExpr* expr, const char* input, EvalScratch* scratch)
+{
+    if (!input) return false;
+
+    if (!validate_expression_syntax(input, scratch)) return false;
+
+    if (!scratch->op_stack)
+    {
+        scratch->op_stack = char_stack_create(INITIAL_STACK_SIZE);
+        if (!scratch->op_stack) return false;
+    }
+    CharStack* op_stack = scratch->op_stack;
+    op_stack->top = -1;
 
     bool can_be_sign = true;
     int i = 0;
@@ -317,45 +689,41 @@ BigInt* eval_expression(const char* input, bool* error_already_printed)
 
         if (isdigit(input[i]))
         {
-            size_t capacity = INITIAL_NUMBER_BUFFER_SIZE;
-            size_t length = 0;
-            char* dynamic_tmp_buf = malloc(capacity);
-
-            if (!dynamic_tmp_buf)
-            {
-                stack_destroy(num_stack, true);
-                char_stack_destroy(op_stack);
-                return NULL;
-            }
+            const char* start = input + i;
+            size_t length;
+            BigInt* literal;
 
             while (input[i] != '\0' && (isxdigit(input[i]) ||
                 input[i] == 'x' || input[i] == 'X' ||
                 input[i] == 'b' || input[i] == 'B'))
             {
-                if (length + 1 >= capacity)
-                {
-                    capacity *= 2;
-                    char* new_buf = realloc(dynamic_tmp_buf, capacity);
-                    if (!new_buf)
-                    {
-                        free(dynamic_tmp_buf);
-                        stack_destroy(num_stack, true);
-                        char_stack_destroy(op_stack);
-                        return NULL;
-                    }
-                    dynamic_tmp_buf = new_buf;
-                }
-                dynamic_tmp_buf[length++] = input[i++];
+                i++;
             }
-            dynamic_tmp_buf[length] = '\0';
+            length = (size_t)(input + i - start);
 
-            stack_push(num_stack, bi_from_str(dynamic_tmp_buf));
-            free(dynamic_tmp_buf);
+            /* Literals are converted once, at compile time */
+            literal = parse_literal(start, length);
+            if (!literal || !expr_emit(expr, EXPR_LITERAL, literal))
+            {
+                bi_destroy(literal);
+                expr_reset(expr);
+                return false;
+            }
 
             can_be_sign = false;
             continue;
         }
 
+        /* The function waits below its parenthesis until the call is closed */
+        if (isalpha((unsigned char)input[i]))
+        {
+            const char* name = input + i;
+
+            while (isalpha((unsigned char)input[i])) i++;
+            char_stack_push(op_stack, function_op(name, (size_t)(input + i - name)));
+            continue;
+        }
+
         if (input[i] == '(')
         {
             char_stack_push(op_stack, input[i++]);
@@ -363,18 +731,39 @@ BigInt* eval_expression(const char* input, bool* error_already_printed)
             continue;
         }
 
+        /* Arguments are complete expressions */
+        if (input[i] == ',')
+        {
+            while (char_stack_peek(op_stack) != '(')
+            {
+                if (!expr_emit(expr, char_stack_pop(op_stack), NULL))
+                {
+                    expr_reset(expr);
+                    return false;
+                }
+            }
+            i++;
+            can_be_sign = true;
+            continue;
+        }
+
         if (input[i] == ')')
         {
             while (!char_stack_is_empty(op_stack) && char_stack_peek(op_stack) != '(')
             {
-                if (!apply_operation(num_stack, char_stack_pop(op_stack),error_already_printed))
+                if (!expr_emit(expr, char_stack_pop(op_stack), NULL))
                 {
-                    stack_destroy(num_stack, true);
-                    char_stack_destroy(op_stack);
-                    return NULL;
+                    expr_reset(expr);
+                    return false;
                 }
             }
             char_stack_pop(op_stack);
+            if (!char_stack_is_empty(op_stack) && char_stack_peek(op_stack) == EXPR_POWMOD &&
+                !expr_emit(expr, char_stack_pop(op_stack), NULL))
+            {
+                expr_reset(expr);
+                return false;
+            }
             i++;
             can_be_sign = false;
             continue;
@@ -401,9 +790,8 @@ BigInt* eval_expression(const char* input, bool* error_already_printed)
                 else
                 {
                     /* *, /, %, ^, ! cannot be unary */
-                    stack_destroy(num_stack, true);
-                    char_stack_destroy(op_stack);
-                    return NULL;
+                    expr_reset(expr);
+                    return false;
                 }
             }
 
@@ -414,11 +802,10 @@ BigInt* eval_expression(const char* input, bool* error_already_printed)
                 if (curr_op == '^' && char_stack_peek(op_stack) == '^') break;
                 if (curr_op == '^' && get_priority(char_stack_peek(op_stack)) == get_priority(curr_op)) break;
 
-                if (!apply_operation(num_stack, char_stack_pop(op_stack),error_already_printed))
+                if (!expr_emit(expr, char_stack_pop(op_stack), NULL))
                 {
-                    stack_destroy(num_stack, true);
-                    char_stack_destroy(op_stack);
-                    return NULL;
+                    expr_reset(expr);
+                    return false;
                 }
             }
 
@@ -434,17 +821,309 @@ BigInt* eval_expression(const char* input, bool* error_already_printed)
 
     while (!char_stack_is_empty(op_stack))
     {
-        if (!apply_operation(num_stack, char_stack_pop(op_stack),error_already_printed))
+        if (!expr_emit(expr, char_stack_pop(op_stack), NULL))
+        {
+            expr_reset(expr);
+            return false;
+        }
+    }
+
+    expr_optimize(expr);
+    return true;
+}
+
+CompiledExpr* expr_compile(const char* input)
+{
+    EvalScratch scratch = { NULL, NULL, NULL, 0 };
+    CompiledExpr* expr = calloc(1, sizeof(CompiledExpr));
+    bool ok;
+
+    if (!expr) return NULL;
+
+    ok = expr_compile_into(expr, input, &scratch);
+    scratch_release(&scratch);
+    if (!ok)
+    {
+        expr_destroy(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+
+/* Executes expr on the operand stack of scratch, which is left empty */
+static BigInt* expr_execute_with(const CompiledExpr* expr, EvalStatus* status, EvalScratch* scratch)
+{
+    BigIntStack* num_stack;
+    BigInt* value;
+    size_t i;
+
+    *status = EVAL_OK;
+    if (!expr)
+    {
+        *status = EVAL_SYNTAX_ERROR;
+        return NULL;
+    }
+
+    if (!scratch->num_stack)
+    {
+        scratch->num_stack = stack_create(INITIAL_STACK_SIZE);
+        if (!scratch->num_stack)
         {
-            stack_destroy(num_stack, true);
-            char_stack_destroy(op_stack);
+            *status = EVAL_SYNTAX_ERROR;
             return NULL;
         }
     }
+    num_stack = scratch->num_stack;
+
+    for (i = 0; i < expr->length; i++)
+    {
+        const ExprInstr* instr = &expr->code[i];
+
+        if (instr->op == EXPR_LITERAL)
+        {
+            /* The operations work in place, the literal itself is kept */
+            value = bi_copy(instr->value);
+            if (!value || !stack_push(num_stack, value))
+            {
+                bi_destroy(value);
+                break;
+            }
+        }
+        else if (instr->op == EXPR_ERROR)
+        {
+            *status = instr->error;
+            break;
+        }
+        else if (!apply_operation(num_stack, instr->op, status))
+        {
+            break;
+        }
+    }
+
+    value = i == expr->length ? stack_pop(num_stack) : NULL;
+    while (!stack_is_empty(num_stack))
+    {
+        bi_destroy(stack_pop(num_stack));
+    }
+
+    if (!value && *status == EVAL_OK) *status = EVAL_SYNTAX_ERROR;
+    return value;
+}
+
+BigInt* expr_execute(const CompiledExpr* expr, EvalStatus* status)
+{
+    EvalScratch scratch = { NULL, NULL, NULL, 0 };
+    BigInt* value = expr_execute_with(expr, status, &scratch);
+
+    scratch_release(&scratch);
+    return value;
+}
+
+void expr_destroy(CompiledExpr* expr)
+{
+    size_t i;
+
+    if (!expr) return;
+
+    for (i = 0; i < expr->length; i++)
+    {
+        bi_destroy(expr->code[i].value);
+    }
+    free(expr->code);
+    free(expr);
+}
+
+#define INITIAL_OUTPUT_SIZE 4096
+
+struct EvalContext
+{
+    BiPool* pool;           /* Kept between evaluations, like the rest */
+    EvalScratch scratch;
+    CompiledExpr code;      /* Compiled form of the row being evaluated */
+    char* output;           /* Results of the last batch */
+    size_t output_capacity;
+    EvalStatus status;
+};
+
+/* Compiles input into the empty code and executes it, leaving the code empty again */
+static BigInt* evaluate(const char* input, EvalStatus* status, CompiledExpr* code, EvalScratch* scratch)
+{
+    BigInt* result;
+    ProfileSample sample;
+    bool compiled;
+
+    if (profile_enabled())
+    {
+        profile_begin(&sample);
+        compiled = expr_compile_into(code, input, scratch);
+        profile_end(&sample, PROFILE_PARSE, 0);
+    }
+    else
+    {
+        compiled = expr_compile_into(code, input, scratch);
+    }
+    result = expr_execute_with(compiled ? code : NULL, status, scratch);
+    expr_reset(code);
+    return result;
+}
+
+BigInt* eval_expression(const char* input, EvalStatus* status)
+{
+    BiPool* pool;
+    BiPool* previous;
+    BigInt* result;
+    EvalScratch scratch = { NULL, NULL, NULL, 0 };
+    CompiledExpr code = { NULL, 0, 0 };
+
+    /* Temporaries of one evaluation recycle each other's memory */
+    pool = bi_pool_create();
+    previous = bi_pool_activate(pool);
+
+    result = evaluate(input, status, &code, &scratch);
+    scratch_release(&scratch);
+    free(code.code);
+
+    bi_pool_activate(previous);
+    bi_pool_destroy(pool);
+    return result;
+}
+
+EvalContext* eval_context_create(void)
+{
+    EvalContext* ctx = (EvalContext*)calloc(1, sizeof(EvalContext));
+
+    if (!ctx) return NULL;
+
+    ctx->pool = bi_pool_create();
+    if (!ctx->pool)
+    {
+        free(ctx);
+        return NULL;
+    }
+    ctx->status = EVAL_OK;
+    return ctx;
+}
+
+void eval_context_destroy(EvalContext* ctx)
+{
+    if (!ctx) return;
+
+    scratch_release(&ctx->scratch);
+    free(ctx->code.code);
+    free(ctx->output);
+    bi_pool_destroy(ctx->pool);
+    free(ctx);
+}
+
+BigInt* eval_context_evaluate(EvalContext* ctx, const char* input)
+{
+    BiPool* previous;
+    BigInt* result;
+
+    if (!ctx) return NULL;
+
+    previous = bi_pool_activate(ctx->pool);
+    result = evaluate(input, &ctx->status, &ctx->code, &ctx->scratch);
+    bi_pool_activate(previous);
+    return result;
+}
+
+BigInt* eval_context_execute(EvalContext* ctx, const CompiledExpr* expr)
+{
+    BiPool* previous;
+    BigInt* result;
+
+    if (!ctx) return NULL;
+
+    previous = bi_pool_activate(ctx->pool);
+    result = expr_execute_with(expr, &ctx->status, &ctx->scratch);
+    bi_pool_activate(previous);
+    return result;
+}
+
+/* Makes room for required more characters of output, the capacity doubles */
+static bool output_reserve(EvalContext* ctx, size_t used, size_t required)
+{
+    size_t new_capacity;
+    char* new_output;
+
+    if (used + required <= ctx->output_capacity) return true;
+
+    new_capacity = ctx->output_capacity ? ctx->output_capacity : INITIAL_OUTPUT_SIZE;
+    while (new_capacity < used + required) new_capacity *= 2;
+
+    new_output = (char*)realloc(ctx->output, new_capacity);
+    if (!new_output) return false;
+    ctx->output = new_output;
+    ctx->output_capacity = new_capacity;
+    return true;
+}
+
+const char* eval_context_evaluate_batch(EvalContext* ctx, const char* const* inputs, size_t count,
+                                        size_t* offsets, EvalStatus* statuses)
+{
+    BiPool* previous;
+    BigInt* result;
+    EvalStatus status;
+    size_t used = 0, length, i;
+    bool ok;
+
+    if (!ctx || (count > 0 && (!inputs || !offsets))) return NULL;
+
+    previous = bi_pool_activate(ctx->pool);
+    ok = output_reserve(ctx, 0, 1);
+    ctx->status = EVAL_OK;
+
+    for (i = 0; ok && i < count; i++)
+    {
+        result = evaluate(inputs[i], &status, &ctx->code, &ctx->scratch);
+
+        /* A failed item leaves an empty string */
+        ok = output_reserve(ctx, used, result ? bi_dec_size(result) + 1 : 1);
+        if (ok)
+        {
+            offsets[i] = used;
+            length = result ? bi_format_dec(result, ctx->output + used) : 0;
+            if (length == 0)
+            {
+                ctx->output[used] = '\0';
+                if (result) status = EVAL_SYNTAX_ERROR;
+            }
+            used += length + 1;
+        }
+        bi_destroy(result);
+
+        if (statuses) statuses[i] = status;
+        if (ctx->status == EVAL_OK) ctx->status = status;
+    }
+
+    bi_pool_activate(previous);
+    if (!ok)
+    {
+        ctx->status = EVAL_SYNTAX_ERROR;
+        return NULL;
+    }
+    return ctx->output;
+}
 
-    BigInt* final_result = stack_pop(num_stack);
+EvalStatus eval_context_status(const EvalContext* ctx)
+{
+    return ctx ? ctx->status : EVAL_SYNTAX_ERROR;
+}
+
+const char* eval_context_message(const EvalContext* ctx)
+{
+    return eval_status_message(eval_context_status(ctx));
+}
 
-    stack_destroy(num_stack, true);
-    char_stack_destroy(op_stack);
-    return final_result;
-}
\ No newline at end of file
+const char* eval_status_message(EvalStatus status)
+{
+    switch (status)
+    {
+    case EVAL_OK: return NULL;
+    case EVAL_DIVISION_BY_ZERO: return "Division by zero!";
+    case EVAL_NEGATIVE_FACTORIAL: return "Input of factorial must not be negative!";
+    default: return "Syntax error!";
+    }
+}
@@ -12,11 +12,151 @@
 #define POW_DIGITS_LIMIT 10 /* Maximum exponent size for pow operation */
 
 /**
- * @brief Evaluates a mathematical expression
+ * @enum EvalStatus
+ * @brief Outcome of an evaluation, errors are left to the caller to report.
+ */
+typedef enum
+{
+    EVAL_OK,
+    EVAL_SYNTAX_ERROR,        /* Invalid expression or out of memory */
+    EVAL_DIVISION_BY_ZERO,
+    EVAL_NEGATIVE_FACTORIAL
+} EvalStatus;
+
+#define EXPR_LITERAL 'L' /* Instruction pushing a literal */
+#define EXPR_ERROR 'E'   /* Instruction failing with a status found at compile time */
+#define EXPR_POWMOD 'P'  /* Instruction of powmod(a, b, m) and fused a^b % m, takes three operands */
+#define EXPR_MULMOD 'M'  /* Instruction of fused a*b % m, takes three operands */
+
+/**
+ * @struct ExprInstr
+ * @brief One instruction of a compiled expression in RPN order.
+ * @var ExprInstr::op Operator character ('m' for unary minus), EXPR_POWMOD, EXPR_MULMOD, EXPR_LITERAL or EXPR_ERROR.
+ * @var ExprInstr::value Owned value of an EXPR_LITERAL instruction.
+ * @var ExprInstr::error Status reported by an EXPR_ERROR instruction.
+ */
+typedef struct
+{
+    char op;
+    BigInt* value;
+    EvalStatus error;
+} ExprInstr;
+
+/**
+ * @struct CompiledExpr
+ * @brief Expression compiled to RPN code, reusable for any number of executions.
+ * @var CompiledExpr::code Array of instructions.
+ * @var CompiledExpr::length Number of instructions.
+ * @var CompiledExpr::capacity Number of allocated instructions.
+ */
+typedef struct
+{
+    ExprInstr* code;
+    size_t length;
+    size_t capacity;
+} CompiledExpr;
+
+/**
+ * @brief Compiles an expression. Literals are converted and constant operations folded.
+ * @param input The expression string to compile
+ * @return Compiled expression, or NULL on syntax error or allocation failure
+ */
+CompiledExpr* expr_compile(const char* input);
+
+/**
+ * @brief Executes a compiled expression, prints nothing
+ * @param expr Compiled expression, NULL is reported as a syntax error
+ * @param status Receives the outcome of the execution
+ * @return Result as BigInt, or NULL on error
+ */
+BigInt* expr_execute(const CompiledExpr* expr, EvalStatus* status);
+
+/**
+ * @brief Frees a compiled expression and its literals
+ * @param expr Compiled expression, may be NULL
+ */
+void expr_destroy(CompiledExpr* expr);
+
+/**
+ * @brief Compiles and executes a mathematical expression, prints nothing
  * @param input The expression string to evaluate
- * @param error_already_printed Pointer to flag indicating if error was printed
+ * @param status Receives the outcome of the evaluation
  * @return Result as BigInt, or NULL on error
  */
-BigInt* eval_expression(const char* input, bool* error_already_printed);
+BigInt* eval_expression(const char* input, EvalStatus* status);
+
+/**
+ * @brief Opaque evaluation context: the allocation pool and the outcome of its last evaluation.
+ * * One context serves one thread at a time, any number of contexts may be
+ * used in parallel. The memo cache, the profile counters and the worker
+ * threads stay shared and synchronize internally.
+ */
+typedef struct EvalContext EvalContext;
+
+/**
+ * @brief Creates an evaluation context.
+ * @return New context, or NULL if allocation fails.
+ */
+EvalContext* eval_context_create(void);
+
+/**
+ * @brief Frees a context and the memory it keeps for reuse. Results it returned stay valid.
+ * @param ctx Context to destroy, may be NULL.
+ */
+void eval_context_destroy(EvalContext* ctx);
+
+/**
+ * @brief Compiles and executes an expression in a context, prints nothing
+ * * The temporaries recycle memory kept by the context from its earlier
+ * evaluations.
+ * @param ctx Context, its status receives the outcome.
+ * @param input The expression string to evaluate
+ * @return Result as BigInt owned by the caller, or NULL on error
+ */
+BigInt* eval_context_evaluate(EvalContext* ctx, const char* input);
+
+/**
+ * @brief Executes a compiled expression in a context, prints nothing
+ * @param ctx Context, its status receives the outcome.
+ * @param expr Compiled expression, may be shared by contexts of several threads.
+ * @return Result as BigInt owned by the caller, or NULL on error
+ */
+BigInt* eval_context_execute(EvalContext* ctx, const CompiledExpr* expr);
+
+/**
+ * @brief Evaluates many expressions with one set of stacks, scratch memory and output buffer
+ * * The decimal results are stored one after another in a buffer owned by
+ * the context, each terminated by '\0'; a failed item stores an empty
+ * string. The context status becomes the first error of the batch, or EVAL_OK.
+ * @param ctx Context.
+ * @param inputs Expression strings.
+ * @param count Number of expressions.
+ * @param offsets Receives the position of every result in the buffer.
+ * @param statuses Receives the outcome of every item, may be NULL.
+ * @return Buffer valid until the next batch or the destruction of ctx, NULL if it cannot grow
+ */
+const char* eval_context_evaluate_batch(EvalContext* ctx, const char* const* inputs, size_t count,
+                                        size_t* offsets, EvalStatus* statuses);
+
+/**
+ * @brief Returns the outcome of the last evaluation of a context
+ * @param ctx Context, NULL gives EVAL_SYNTAX_ERROR.
+ * @return Status of the last evaluation, EVAL_OK before the first one
+ */
+EvalStatus eval_context_status(const EvalContext* ctx);
+
+/**
+ * @brief Returns the message of the last evaluation error of a context
+ * @param ctx Context.
+ * @return Constant message as from eval_status_message(), NULL after a success
+ */
+const char* eval_context_message(const EvalContext* ctx);
+
+/**
+ * @brief Returns the message printed for an evaluation error
+ * @param status Outcome returned by eval_expression()
+ * @return Constant message, or NULL for EVAL_OK
+ */
+const char* eval_status_message(EvalStatus status);
 
 #endif /* PARSER_H */
\ No newline at end of file
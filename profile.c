@@ -0,0 +1,218 @@
+/**
+ * @file profile.c
+ * @brief Implementation of the evaluator profiling.
+ * * One mutex guards the counters; it is taken once per recorded call, after
+ * the call has been measured.
+ */
+
+#include "profile.h"
+#include "bigint.h"
+#include "parser.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_BUCKETS 64          /* Histogram bucket k counts sizes of [2^(k-1), 2^k) words */
+#define INITIAL_REPORT_SIZE 1024
+
+typedef struct
+{
+    size_t calls;
+    double total_ns;
+    double max_ns;
+    size_t bytes;
+    size_t words;                   /* Sum of the operand sizes */
+    size_t histogram[PROFILE_BUCKETS];
+} ProfileCounters;
+
+typedef struct
+{
+    char* text;
+    size_t length;
+    size_t capacity;
+    bool ok;
+} ReportBuffer;
+
+static const char* const kind_names[PROFILE_KINDS] =
+{
+    "+", "-", "*", "/", "%", "^", "!", "neg", "powmod", "mulmod", "parse",
+    "from_dec", "from_hex", "from_bin", "to_dec", "to_hex", "to_bin", "to_raw", "to_digits"
+};
+
+static bool profiling = false;
+static ProfileCounters counters[PROFILE_KINDS];
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* HELP FUNCTIONS */
+
+static size_t size_bucket(size_t words)
+{
+    size_t k = 0;
+
+    while (words > 0 && k < PROFILE_BUCKETS - 1)
+    {
+        words >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/* Appends formatted text, the buffer is marked as failed if it cannot grow */
+static void report_append(ReportBuffer* report, const char* format, ...)
+{
+    va_list args;
+    int needed;
+    size_t new_capacity;
+    char* new_text;
+
+    if (!report->ok) return;
+
+    va_start(args, format);
+    needed = vsnprintf(report->text + report->length, report->capacity - report->length, format, args);
+    va_end(args);
+    if (needed < 0)
+    {
+        report->ok = false;
+        return;
+    }
+
+    if ((size_t)needed >= report->capacity - report->length)
+    {
+        new_capacity = report->capacity;
+        while ((size_t)needed >= new_capacity - report->length) new_capacity *= 2;
+        new_text = (char*)realloc(report->text, new_capacity);
+        if (!new_text)
+        {
+            report->ok = false;
+            return;
+        }
+        report->text = new_text;
+        report->capacity = new_capacity;
+
+        va_start(args, format);
+        vsnprintf(report->text + report->length, report->capacity - report->length, format, args);
+        va_end(args);
+    }
+    report->length += (size_t)needed;
+}
+
+/* PROFILING FUNCTIONS */
+
+void profile_set_enabled(bool enabled)
+{
+    profiling = enabled;
+}
+
+bool profile_enabled(void)
+{
+    return profiling;
+}
+
+ProfileKind profile_operator_kind(char op)
+{
+    switch (op)
+    {
+    case '+': return PROFILE_ADD;
+    case '-': return PROFILE_SUB;
+    case '*': return PROFILE_MUL;
+    case '/': return PROFILE_DIV;
+    case '%': return PROFILE_MOD;
+    case '^': return PROFILE_POW;
+    case '!': return PROFILE_FACT;
+    case 'm': return PROFILE_NEG;
+    case EXPR_POWMOD: return PROFILE_POWMOD;
+    case EXPR_MULMOD: return PROFILE_MULMOD;
+    default: return PROFILE_KINDS;
+    }
+}
+
+void profile_begin(ProfileSample* sample)
+{
+    sample->start_bytes = bi_allocated_bytes();
+    sample->start_ns = util_now_ns();
+}
+
+void profile_end(const ProfileSample* sample, ProfileKind kind, size_t words)
+{
+    double elapsed = util_now_ns() - sample->start_ns;
+    size_t bytes = bi_allocated_bytes() - sample->start_bytes;
+    ProfileCounters* c;
+
+    if (kind >= PROFILE_KINDS) return;
+
+    pthread_mutex_lock(&profile_lock);
+    c = &counters[kind];
+    c->calls++;
+    c->total_ns += elapsed;
+    if (elapsed > c->max_ns) c->max_ns = elapsed;
+    c->bytes += bytes;
+    c->words += words;
+    c->histogram[size_bucket(words)]++;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+char* profile_report(void)
+{
+    ReportBuffer report;
+    ProfileCounters snapshot[PROFILE_KINDS];
+    size_t kind, k;
+    bool any = false;
+
+    report.text = (char*)malloc(INITIAL_REPORT_SIZE);
+    report.length = 0;
+    report.capacity = INITIAL_REPORT_SIZE;
+    report.ok = report.text != NULL;
+    if (!report.ok) return NULL;
+    report.text[0] = '\0';
+
+    pthread_mutex_lock(&profile_lock);
+    memcpy(snapshot, counters, sizeof(counters));
+    pthread_mutex_unlock(&profile_lock);
+
+    report_append(&report, "%-9s %10s %12s %12s %12s %10s %12s", "op", "calls", "total ms",
+                  "avg us", "max us", "avg words", "alloc KiB");
+    for (kind = 0; kind < PROFILE_KINDS; kind++)
+    {
+        const ProfileCounters* c = &snapshot[kind];
+
+        if (c->calls == 0) continue;
+        report_append(&report, "\n%-9s %10lu %12.3f %12.1f %12.1f %10lu %12.1f", kind_names[kind],
+                      (unsigned long)c->calls, c->total_ns / 1e6, c->total_ns / 1e3 / (double)c->calls,
+                      c->max_ns / 1e3, (unsigned long)(c->words / c->calls), (double)c->bytes / 1024.0);
+        any = true;
+    }
+    if (!any) report_append(&report, "\n(no calls recorded)");
+    else report_append(&report, "\nalloc KiB counts the evaluating thread only, not the workers of --threads");
+
+    /* Histograms, only for kinds with operands; a bucket is labelled by its lowest size */
+    for (kind = 0; kind < PROFILE_KINDS; kind++)
+    {
+        const ProfileCounters* c = &snapshot[kind];
+
+        if (c->words == 0) continue;
+        report_append(&report, "\n%-9s words", kind_names[kind]);
+        for (k = 0; k < PROFILE_BUCKETS; k++)
+        {
+            if (c->histogram[k] == 0) continue;
+            report_append(&report, " %lu:%lu", (unsigned long)(k == 0 ? 0 : (size_t)1 << (k - 1)),
+                          (unsigned long)c->histogram[k]);
+        }
+    }
+
+    if (!report.ok)
+    {
+        free(report.text);
+        return NULL;
+    }
+    return report.text;
+}
+
+void profile_reset(void)
+{
+    pthread_mutex_lock(&profile_lock);
+    memset(counters, 0, sizeof(counters));
+    pthread_mutex_unlock(&profile_lock);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file profile.h
+ * @brief Opt-in profiling of the operators and conversions of the evaluator.
+ * * Every recorded call adds its wall time, the memory the calling thread
+ * allocated for BigInt values (pool workers of a parallel operation are not
+ * counted) and the word size of its largest operand to the counters of
+ * its kind; the sizes are also sorted into a power of two histogram. The
+ * counters are shared by all threads. While profiling is off, the hooks cost
+ * one branch.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * @brief Kinds of recorded calls.
+ */
+typedef enum
+{
+    PROFILE_ADD,
+    PROFILE_SUB,
+    PROFILE_MUL,
+    PROFILE_DIV,
+    PROFILE_MOD,
+    PROFILE_POW,
+    PROFILE_FACT,
+    PROFILE_NEG,
+    PROFILE_POWMOD,
+    PROFILE_MULMOD,
+    PROFILE_PARSE,     /* Compilation of a row, including its literals and folded constants */
+    PROFILE_FROM_DEC,
+    PROFILE_FROM_HEX,
+    PROFILE_FROM_BIN,
+    PROFILE_TO_DEC,
+    PROFILE_TO_HEX,
+    PROFILE_TO_BIN,
+    PROFILE_TO_RAW,
+    PROFILE_TO_DIGITS, /* Summary of the "digits" output */
+    PROFILE_KINDS
+} ProfileKind;
+
+/**
+ * @struct ProfileSample
+ * @brief State of a call in progress, filled in by profile_begin().
+ * @var ProfileSample::start_ns Time of the start in nanoseconds.
+ * @var ProfileSample::start_bytes Value memory allocated by the thread before the call.
+ */
+typedef struct
+{
+    double start_ns;
+    size_t start_bytes;
+} ProfileSample;
+
+/**
+ * @brief Turns profiling on or off. Meant to be called before any evaluation starts.
+ * @param enabled true to record calls.
+ */
+void profile_set_enabled(bool enabled);
+
+/**
+ * @brief Checks whether calls are recorded.
+ * @return true if profiling is on.
+ */
+bool profile_enabled(void);
+
+/**
+ * @brief Maps an operator character of the evaluator to its kind.
+ * @param op Operator character ('m' for unary minus), EXPR_POWMOD or EXPR_MULMOD of parser.h.
+ * @return Kind of the operator, PROFILE_KINDS for unknown characters.
+ */
+ProfileKind profile_operator_kind(char op);
+
+/**
+ * @brief Starts measuring a call on the calling thread.
+ * @param sample Receives the start state.
+ */
+void profile_begin(ProfileSample* sample);
+
+/**
+ * @brief Finishes measuring a call and adds it to the counters.
+ * @param sample State filled in by profile_begin() on the same thread.
+ * @param kind Kind of the call, PROFILE_KINDS is ignored.
+ * @param words Words of the largest operand, 0 if the call has no BigInt operand.
+ */
+void profile_end(const ProfileSample* sample, ProfileKind kind, size_t words);
+
+/**
+ * @brief Formats the counters as a table followed by the histograms of operand sizes.
+ * @return Newly allocated text without a trailing newline, NULL if out of memory.
+ */
+char* profile_report(void);
+
+/**
+ * @brief Clears all counters.
+ */
+void profile_reset(void);
+
+#endif /* PROFILE_H */
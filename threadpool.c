@@ -0,0 +1,260 @@
+/**
+ * @file threadpool.c
+ * @brief Implementation of the work-stealing thread pool.
+ * * The deques are guarded by one pool mutex. Tasks are meant to be coarse
+ * (large multiplications and conversions), so the lock is taken rarely
+ * compared to the work done by a task. Workers find their deque through a
+ * thread-specific key, so no compiler extension for thread-local storage is needed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEQUE_INITIAL_CAPACITY 16  /* Initial number of task slots per deque */
+
+typedef struct
+{
+    ThreadTask** items;
+    size_t head;       /* Oldest task, stolen first */
+    size_t tail;       /* One past the newest task, popped by the owner */
+    size_t capacity;
+} TaskDeque;
+
+typedef struct
+{
+    pthread_t* threads;
+    TaskDeque* deques;        /* One per worker and a shared one for other threads */
+    size_t workers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;   /* Signalled on new tasks and finished tasks */
+    pthread_key_t worker_key; /* Worker index + 1, NULL for threads outside of the pool */
+    bool stopping;
+} ThreadPool;
+
+static ThreadPool* pool = NULL;
+
+/* HELP FUNCTIONS */
+
+/* Deque of the calling thread, threads outside of the pool share the last one */
+static size_t own_deque(void)
+{
+    void* id = pthread_getspecific(pool->worker_key);
+
+    return id ? (size_t)id - 1 : pool->workers;
+}
+
+static bool deque_push(TaskDeque* deque, ThreadTask* task)
+{
+    ThreadTask** new_items;
+    size_t new_capacity;
+
+    if (deque->tail == deque->capacity)
+    {
+        if (deque->head > 0)
+        {
+            /* Reuse the slots freed by thieves */
+            memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(ThreadTask*));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        }
+        else
+        {
+            new_capacity = deque->capacity ? deque->capacity * 2 : DEQUE_INITIAL_CAPACITY;
+            new_items = (ThreadTask**)realloc(deque->items, new_capacity * sizeof(ThreadTask*));
+            if (!new_items) return false;
+            deque->items = new_items;
+            deque->capacity = new_capacity;
+        }
+    }
+    deque->items[deque->tail++] = task;
+    return true;
+}
+
+/* Takes the newest own task, or steals the oldest task of another deque. Lock is held. */
+static ThreadTask* take_task(size_t self)
+{
+    TaskDeque* deque = &pool->deques[self];
+    ThreadTask* task;
+    size_t i, victim;
+
+    if (deque->tail > deque->head)
+    {
+        task = deque->items[--deque->tail];
+        if (deque->tail == deque->head) deque->head = deque->tail = 0;
+        return task;
+    }
+
+    for (i = 1; i <= pool->workers; i++)
+    {
+        victim = (self + i) % (pool->workers + 1);
+        deque = &pool->deques[victim];
+        if (deque->tail > deque->head)
+        {
+            task = deque->items[deque->head++];
+            if (deque->tail == deque->head) deque->head = deque->tail = 0;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/* Runs a task outside of the lock and marks it as done. Lock is held on entry and exit. */
+static void run_task(ThreadTask* task)
+{
+    pthread_mutex_unlock(&pool->lock);
+    task->func(task->arg);
+    pthread_mutex_lock(&pool->lock);
+
+    task->done = 1;
+    pthread_cond_broadcast(&pool->changed);
+}
+
+static void* worker_main(void* arg)
+{
+    size_t self = (size_t)arg;
+    ThreadTask* task;
+
+    pthread_setspecific(pool->worker_key, (void*)(self + 1));
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stopping)
+    {
+        task = take_task(self);
+        if (task)
+        {
+            run_task(task);
+        }
+        else
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* POOL FUNCTIONS */
+
+bool thread_pool_start(size_t workers)
+{
+    size_t i;
+
+    if (pool || workers == 0) return false;
+
+    pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool) return false;
+
+    pool->threads = (pthread_t*)malloc(workers * sizeof(pthread_t));
+    pool->deques = (TaskDeque*)calloc(workers + 1, sizeof(TaskDeque));
+    if (!pool->threads || !pool->deques || pthread_key_create(&pool->worker_key, NULL) != 0)
+    {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        pool = NULL;
+        return false;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    pool->workers = workers;
+    for (i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, (void*)i) != 0) break;
+    }
+
+    if (i < workers)
+    {
+        /* Only the threads created so far are stopped */
+        pthread_mutex_lock(&pool->lock);
+        pool->workers = i;
+        pthread_mutex_unlock(&pool->lock);
+        thread_pool_stop();
+        return false;
+    }
+    return true;
+}
+
+void thread_pool_stop(void)
+{
+    size_t i;
+
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->workers; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (i = 0; i <= pool->workers; i++)
+    {
+        free(pool->deques[i].items);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->changed);
+    pthread_key_delete(pool->worker_key);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+    pool = NULL;
+}
+
+size_t thread_pool_size(void)
+{
+    return pool ? pool->workers : 0;
+}
+
+void thread_pool_spawn(ThreadTask* task, ThreadTaskFunc func, void* arg)
+{
+    bool queued = false;
+
+    task->func = func;
+    task->arg = arg;
+    task->done = 0;
+
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        queued = deque_push(&pool->deques[own_deque()], task);
+        if (queued) pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    /* Without a pool, or if the deque cannot grow, the task runs right away */
+    if (!queued)
+    {
+        func(arg);
+        task->done = 1;
+    }
+}
+
+void thread_pool_join(ThreadTask* task)
+{
+    ThreadTask* other;
+
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done)
+    {
+        other = take_task(own_deque());
+        if (other)
+        {
+            run_task(other);
+        }
+        else
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,67 @@
+/**
+ * @file threadpool.h
+ * @brief Work-stealing thread pool for fork-join parallelism.
+ * * Every worker owns a deque of tasks: it pushes and pops new tasks at the
+ * bottom, while idle workers steal the oldest tasks from the top of the
+ * others. A thread waiting for a task keeps executing queued tasks, so nested
+ * fork-join code never blocks all workers.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * @brief Function executed by a task.
+ */
+typedef void (*ThreadTaskFunc)(void* arg);
+
+/**
+ * @struct ThreadTask
+ * @brief Task handle, owned by the caller until thread_pool_join() returns.
+ * @var ThreadTask::func Function to execute.
+ * @var ThreadTask::arg Argument passed to the function.
+ * @var ThreadTask::done Set once the function has returned.
+ */
+typedef struct
+{
+    ThreadTaskFunc func;
+    void* arg;
+    int done;
+} ThreadTask;
+
+/**
+ * @brief Starts the global pool with the given number of worker threads.
+ * @param workers Number of workers, the threads calling thread_pool_join() help them.
+ * @return true on success, false if already running or threads cannot be created.
+ */
+bool thread_pool_start(size_t workers);
+
+/**
+ * @brief Stops the global pool. No task may be pending.
+ */
+void thread_pool_stop(void);
+
+/**
+ * @brief Returns the number of workers of the running pool.
+ * @return Number of workers, 0 if no pool is running.
+ */
+size_t thread_pool_size(void);
+
+/**
+ * @brief Queues a task. Without a running pool the task is executed immediately.
+ * @param task Handle filled in by the call, must stay valid until joined.
+ * @param func Function to execute.
+ * @param arg Argument passed to the function.
+ */
+void thread_pool_spawn(ThreadTask* task, ThreadTaskFunc func, void* arg);
+
+/**
+ * @brief Waits for a spawned task, executing other queued tasks meanwhile.
+ * @param task Handle passed to thread_pool_spawn().
+ */
+void thread_pool_join(ThreadTask* task);
+
+#endif /* THREADPOOL_H */
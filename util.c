@@ -0,0 +1,92 @@
+/**
+ * @file util.c
+ * @brief Implementation of the shared helpers.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "util.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define BASE_DEC 10
+
+double util_now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+unsigned long long util_random_next(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+double util_measure(bool (*run)(void* context), void* context, double min_time_ns, unsigned long* iterations)
+{
+    unsigned long count = 0;
+    double start, elapsed;
+    bool ok;
+
+    start = util_now_ns();
+    ok = run(context);
+    elapsed = util_now_ns() - start;
+    if (elapsed >= min_time_ns) count = 1;
+    else elapsed = 0.0;
+
+    while (ok && (count == 0 || elapsed < min_time_ns))
+    {
+        start = util_now_ns();
+        ok = run(context);
+        elapsed += util_now_ns() - start;
+        count++;
+    }
+
+    if (iterations) *iterations = count;
+    return ok ? elapsed / (double)count : -1.0;
+}
+
+bool util_list_contains(const char* list, const char* name)
+{
+    size_t length = strlen(name);
+    const char* p = list;
+
+    if (!list) return true;
+    while (*p)
+    {
+        if (strncmp(p, name, length) == 0 && (p[length] == ',' || p[length] == '\0')) return true;
+        p = strchr(p, ',');
+        if (!p) break;
+        p++;
+    }
+    return false;
+}
+
+bool util_parse_option_value(const char* text, unsigned long* value)
+{
+    char* end;
+
+    if (!isdigit((unsigned char)*text)) return false;
+    *value = strtoul(text, &end, BASE_DEC);
+    return *end == '\0';
+}
@@ -0,0 +1,55 @@
+/**
+ * @file util.h
+ * @brief Small helpers shared by the front ends, the profiler and the test programs.
+ * * A monotonic clock, the xorshift64* generator of the benchmark and the
+ * fuzz harness, a timing loop for repeated calls and the parsing of command
+ * line lists and numbers.
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Reads a monotonic clock.
+ * @return Time in nanoseconds from an arbitrary starting point.
+ */
+double util_now_ns(void);
+
+/**
+ * @brief Advances a xorshift64* generator.
+ * @param state State of the generator, it must not be zero.
+ * @return The next pseudo-random 64-bit value.
+ */
+unsigned long long util_random_next(unsigned long long* state);
+
+/**
+ * @brief Times a call repeated until at least min_time_ns have passed.
+ * The first call warms up the caches; it is kept only if it alone takes the
+ * minimum time, as for the largest operands.
+ * @param run Called with context, returns false on failure.
+ * @param context Argument of run.
+ * @param min_time_ns Minimum time of the measurement in nanoseconds.
+ * @param iterations Receives the number of timed calls, may be NULL.
+ * @return Time of one call in nanoseconds, or a negative value if a call failed.
+ */
+double util_measure(bool (*run)(void* context), void* context, double min_time_ns, unsigned long* iterations);
+
+/**
+ * @brief Checks whether a name is listed in a comma separated list.
+ * @param list The list, NULL lists every name.
+ * @param name Name to look for.
+ * @return true if the name is listed.
+ */
+bool util_list_contains(const char* list, const char* name);
+
+/**
+ * @brief Reads the decimal value of a command line option.
+ * @param text Text after the '=' of the option.
+ * @param value Receives the value.
+ * @return false if the text is not a decimal number.
+ */
+bool util_parse_option_value(const char* text, unsigned long* value);
+
+#endif /* UTIL_H */